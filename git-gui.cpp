@@ -31,6 +31,7 @@
 #include "lib/logo.h"
 #include "lib/merge.h"
 #include "lib/mergetool.h"
+#include "lib/native.h"
 #include "lib/option.h"
 #include "lib/remote.h"
 #include "lib/remote_add.h"
@@ -668,6 +669,7 @@ proc disable_option {option} {
 
 proc is_many_config {name} {
 	switch -glob -- $name {
+	blame.ignorerevsfile -
 	gui.recentrepo -
 	remote.*.fetch -
 	remote.*.push
@@ -766,7 +768,8 @@ proc _git_cmd {name} {
 		switch -- $name {
 		  version   -
 		--version   -
-		--exec-path { return [list $::_git $name] }
+		--exec-path -
+		-c          { return [list $::_git $name] }
 		}
 
 		set p [gitexec git-$name$::_search_exe]
@@ -903,10 +906,10 @@ proc git {args} {
 	return $result
 }
 
-proc _open_stdout_stderr {cmd} {
+proc _open_stdout_stderr {cmd {mode r}} {
 	_trace_exec $cmd
 	if {[catch {
-			set fd [open [concat [list | ] $cmd] r]
+			set fd [open [concat [list | ] $cmd] $mode]
 		} err]} {
 		if {   [lindex $cmd end] eq {2>@1}
 		    && $err eq {can not find channel named "1"}
@@ -920,7 +923,7 @@ proc _open_stdout_stderr {cmd} {
 				[list | ] \
 				[lrange $cmd 0 end-1] \
 				[list |& cat] \
-				] r]
+				] $mode]
 		} else {
 			error $err
 		}
@@ -931,6 +934,7 @@ proc _open_stdout_stderr {cmd} {
 
 proc git_read {args} {
 	set opt [list]
+	set mode r
 
 	while {1} {
 		switch -- [lindex $args 0] {
@@ -942,6 +946,10 @@ proc git_read {args} {
 			lappend args 2>@1
 		}
 
+		--input {
+			set mode r+
+		}
+
 		default {
 			break
 		}
@@ -954,7 +962,7 @@ proc git_read {args} {
 	set cmdp [_git_cmd [lindex $args 0]]
 	set args [lrange $args 1 end]
 
-	return [_open_stdout_stderr [concat $opt $cmdp $args]]
+	return [_open_stdout_stderr [concat $opt $cmdp $args] $mode]
 }
 
 proc git_write {args} {
@@ -1237,6 +1245,7 @@ set default_config(gui.fastcopyblame) false
 set default_config(gui.maxrecentrepo) 10
 set default_config(gui.copyblamethreshold) 40
 set default_config(gui.blamehistoryctx) 7
+set default_config(gui.blamecachesize) 32
 set default_config(gui.diffcontext) 5
 set default_config(gui.diffopts) {}
 set default_config(gui.commitmsgwidth) 75
@@ -1246,6 +1255,8 @@ set default_config(gui.fontui) [font configure font_ui]
 set default_config(gui.fontdiff) [font configure font_diff]
 # TODO: this option should be added to the git-config documentation
 set default_config(gui.maxfilesdisplayed) 5000
+set default_config(gui.maxpreviewsize) 1048576
+set default_config(gui.worddiff) true
 set default_config(gui.usettk) 1
 set default_config(gui.warndetachedcommit) 1
 set default_config(gui.tabsize) 8
@@ -1393,6 +1404,10 @@ You are using [git-version]:
 }
 	)tcl"_tcl;
 
+	// native helper commands used by the scripts below
+	Tcl_StaticPackage(nullptr, "Gitgui", Gitgui_Init, nullptr);
+	"load {} Gitgui"_tcl;
+
 	eval(lib_class);		// must be the first one
 	eval(lib_blame);
 	eval(lib_branch);
@@ -1573,6 +1588,9 @@ set is_submodule_diff 0
 set is_conflict_diff 0
 set selected_commit_type new
 set diff_empty_count 0
+set diff_hunk_selection [list]
+set diff_preview_id 0
+set word_diff_pending 0
 
 set nullid "0000000000000000000000000000000000000000"
 set nullid2 "0000000000000000000000000000000000000001"
@@ -1743,7 +1761,7 @@ if {[is_Cygwin]} {
 }
 
 proc rescan_stage2 {fd after} {
-	global rescan_active buf_rdi buf_rdf buf_rlo
+	global rescan_active
 
 	if {$fd ne {}} {
 		read $fd
@@ -1764,11 +1782,7 @@ proc rescan_stage2 {fd after} {
 		}
 	}
 
-	set buf_rdi {}
-	set buf_rdf {}
-	set buf_rlo {}
-
-	set rescan_active 2
+	set rescan_active 3
 	ui_status [mc "Scanning for modified files ..."]
 	if {[git-version >= "1.7.2"]} {
 		set fd_di [git_read diff-index --cached --ignore-submodules=dirty -z [PARENT]]
@@ -1776,12 +1790,16 @@ proc rescan_stage2 {fd after} {
 		set fd_di [git_read diff-index --cached -z [PARENT]]
 	}
 	set fd_df [git_read diff-files -z]
+	set fd_lu [git_read ls-files -u -z]
+	merge_stages::clear
 
 	fconfigure $fd_di -blocking 0 -translation binary -encoding binary
 	fconfigure $fd_df -blocking 0 -translation binary -encoding binary
+	fconfigure $fd_lu -blocking 0 -translation binary -encoding binary
 
 	fileevent $fd_di readable [list read_diff_index $fd_di $after]
 	fileevent $fd_df readable [list read_diff_files $fd_df $after]
+	fileevent $fd_lu readable [list read_ls_unmerged $fd_lu $after]
 
 	if {[is_config_true gui.displayuntracked]} {
 		set fd_lo [eval git_read ls-files --others -z $ls_others]
@@ -1880,94 +1898,49 @@ proc prepare_commit_msg_hook_wait {fd_ph} {
 }
 
 proc read_diff_index {fd after} {
-	global buf_rdi
-
-	append buf_rdi [read $fd]
-	set c 0
-	set n [string length $buf_rdi]
-	while {$c < $n} {
-		set z1 [string first "\0" $buf_rdi $c]
-		if {$z1 == -1} break
-		incr z1
-		set z2 [string first "\0" $buf_rdi $z1]
-		if {$z2 == -1} break
-
-		incr c
-		set i [split [string range $buf_rdi $c [expr {$z1 - 2}]] { }]
-		set p [string range $buf_rdi $z1 [expr {$z2 - 1}]]
+	foreach {i p} [read_fields $fd 2] {
+		set i [split [string range $i 1 end] { }]
 		merge_state \
-			[encoding convertfrom utf-8 $p] \
+			$p \
 			[lindex $i 4]? \
 			[list [lindex $i 0] [lindex $i 2]] \
 			[list]
-		set c $z2
-		incr c
-	}
-	if {$c < $n} {
-		set buf_rdi [string range $buf_rdi $c end]
-	} else {
-		set buf_rdi {}
 	}
-
-	rescan_done $fd buf_rdi $after
+	rescan_done $fd $after
 }
 
 proc read_diff_files {fd after} {
-	global buf_rdf
-
-	append buf_rdf [read $fd]
-	set c 0
-	set n [string length $buf_rdf]
-	while {$c < $n} {
-		set z1 [string first "\0" $buf_rdf $c]
-		if {$z1 == -1} break
-		incr z1
-		set z2 [string first "\0" $buf_rdf $z1]
-		if {$z2 == -1} break
-
-		incr c
-		set i [split [string range $buf_rdf $c [expr {$z1 - 2}]] { }]
-		set p [string range $buf_rdf $z1 [expr {$z2 - 1}]]
+	foreach {i p} [read_fields $fd 2] {
+		set i [split [string range $i 1 end] { }]
 		merge_state \
-			[encoding convertfrom utf-8 $p] \
+			$p \
 			?[lindex $i 4] \
 			[list] \
 			[list [lindex $i 0] [lindex $i 2]]
-		set c $z2
-		incr c
 	}
-	if {$c < $n} {
-		set buf_rdf [string range $buf_rdf $c end]
-	} else {
-		set buf_rdf {}
-	}
-
-	rescan_done $fd buf_rdf $after
+	rescan_done $fd $after
 }
 
 proc read_ls_others {fd after} {
-	global buf_rlo
-
-	append buf_rlo [read $fd]
-	set pck [split $buf_rlo "\0"]
-	set buf_rlo [lindex $pck end]
-	foreach p [lrange $pck 0 end-1] {
-		set p [encoding convertfrom utf-8 $p]
+	foreach p [read_fields $fd 1] {
 		if {[string index $p end] eq {/}} {
 			set p [string range $p 0 end-1]
 		}
 		merge_state $p ?O
 	}
-	rescan_done $fd buf_rlo $after
+	rescan_done $fd $after
+}
+
+proc read_ls_unmerged {fd after} {
+	merge_stages::add [read_fields $fd 1]
+	rescan_done $fd $after
 }
 
-proc rescan_done {fd buf after} {
+proc rescan_done {fd after} {
 	global rescan_active current_diff_path
 	global file_states repo_config
-	upvar $buf to_clear
 
 	if {![eof $fd]} return
-	set to_clear {}
 	close $fd
 	if {[incr rescan_active -1] > 0} return
 
@@ -2077,69 +2050,150 @@ proc merge_state {path new_state {head_info {}} {index_info {}}} {
 	return $state
 }
 
-proc display_file_helper {w path icon_name old_m new_m} {
+# The list modes of the state m, in the index and in the working tree.
+#
+proc file_list_modes {m} {
+	set i [string index $m 0]
+	if {$i eq {U}} {
+		return [list _ U]
+	}
+	return [list $i [string index $m 1]]
+}
+
+# Applies removals, additions and icon changes to one file list widget.
+# All lists are sorted by path; added holds path icon mode triples and
+# changed holds icon mode path triples.
+#
+proc update_file_list {w removed added changed} {
 	global file_lists
 
-	if {$new_m eq {_}} {
-		set lno [lsearch -sorted -exact $file_lists($w) $path]
-		if {$lno >= 0} {
-			set file_lists($w) [lreplace $file_lists($w) $lno $lno]
+	if {$removed eq {} && $added eq {} && $changed eq {}} return
+	$w conf -state normal
+
+	if {$removed ne {}} {
+		set fl $file_lists($w)
+		set gone [list]
+		foreach path $removed {
+			set lno [lsearch -sorted -exact $fl $path]
+			if {$lno >= 0} {
+				lappend gone $lno
+			}
+		}
+
+		# Delete runs of adjacent lines at once, bottom up.
+		set runs [list]
+		foreach lno $gone {
+			if {$runs ne {} && [lindex $runs end] == $lno - 1} {
+				lset runs end $lno
+			} else {
+				lappend runs $lno $lno
+			}
+		}
+		foreach {last first} [lreverse $runs] {
+			$w delete [expr {$first + 1}].0 [expr {$last + 2}].0
+		}
+
+		set kept [list]
+		set next 0
+		foreach lno $gone {
+			lappend kept {*}[lrange $fl $next [expr {$lno - 1}]]
+			set next [expr {$lno + 1}]
+		}
+		lappend kept {*}[lrange $fl $next end]
+		set file_lists($w) $kept
+	}
+
+	if {$added ne {}} {
+		set paths [list]
+		foreach {path icon m} $added {
+			lappend paths $path
+		}
+		set file_lists($w) [lsort -unique [concat $file_lists($w) $paths]]
+
+		# In path order every line above an added one is already final.
+		foreach {path icon m} $added {
+			set lno [lsearch -sorted -exact $file_lists($w) $path]
 			incr lno
-			$w conf -state normal
-			$w delete $lno.0 [expr {$lno + 1}].0
-			$w conf -state disabled
+			$w image create $lno.0 \
+				-align center -padx 5 -pady 1 \
+				-name $icon \
+				-image [mapicon $w $m $path]
+			$w insert $lno.1 "[escape_path $path]\n"
 		}
-	} elseif {$old_m eq {_} && $new_m ne {_}} {
-		lappend file_lists($w) $path
-		set file_lists($w) [lsort -unique $file_lists($w)]
-		set lno [lsearch -sorted -exact $file_lists($w) $path]
-		incr lno
-		$w conf -state normal
-		$w image create $lno.0 \
-			-align center -padx 5 -pady 1 \
-			-name $icon_name \
-			-image [mapicon $w $new_m $path]
-		$w insert $lno.1 "[escape_path $path]\n"
-		$w conf -state disabled
-	} elseif {$old_m ne $new_m} {
-		$w conf -state normal
-		$w image conf $icon_name -image [mapicon $w $new_m $path]
-		$w conf -state disabled
 	}
+
+	foreach {icon m path} $changed {
+		$w image conf $icon -image [mapicon $w $m $path]
+	}
+
+	$w conf -state disabled
 }
 
-proc display_file {path state} {
-	global file_states selected_paths
+# Shows the pending state changes in the file lists. Changes recorded by
+# display_file are applied here in a single pass per widget, once the
+# event loop is idle, or earlier if someone needs the file lists.
+#
+proc flush_display_files {} {
+	global file_states pending_display
 	global ui_index ui_workdir
 
-	set old_m [merge_state $path $state]
-	set s $file_states($path)
-	set new_m [lindex $s 0]
-	set icon_name [lindex $s 1]
+	if {[array size pending_display] == 0} return
 
-	set o [string index $old_m 0]
-	set n [string index $new_m 0]
-	if {$o eq {U}} {
-		set o _
+	set ws [list $ui_index $ui_workdir]
+	foreach w $ws {
+		set removed($w) [list]
+		set added($w) [list]
+		set changed($w) [list]
 	}
-	if {$n eq {U}} {
-		set n _
+	foreach path [lsort [array names pending_display]] {
+		foreach {old_m old_icon} $pending_display($path) break
+		if {[catch {set s $file_states($path)}]} {
+			set new_m __
+			set icon $old_icon
+		} else {
+			set new_m [lindex $s 0]
+			set icon [lindex $s 1]
+		}
+
+		foreach w $ws o [file_list_modes $old_m] n [file_list_modes $new_m] {
+			# A path that went away and came back has a new icon.
+			if {$icon ne $old_icon && $o ne {_}} {
+				lappend removed($w) $path
+				set o _
+			}
+			if {$n eq {_}} {
+				if {$o ne {_}} {
+					lappend removed($w) $path
+				}
+			} elseif {$o eq {_}} {
+				lappend added($w) $path $icon $n
+			} elseif {$o ne $n} {
+				lappend changed($w) $icon $n $path
+			}
+		}
 	}
-	display_file_helper	$ui_index $path $icon_name $o $n
+	array unset pending_display
 
-	if {[string index $old_m 0] eq {U}} {
-		set o U
-	} else {
-		set o [string index $old_m 1]
+	foreach w $ws {
+		update_file_list $w $removed($w) $added($w) $changed($w)
 	}
-	if {[string index $new_m 0] eq {U}} {
-		set n U
-	} else {
-		set n [string index $new_m 1]
+}
+
+proc display_file {path state} {
+	global file_states selected_paths pending_display
+
+	if {[array size pending_display] == 0} {
+		after idle flush_display_files
+	}
+
+	set old_m [merge_state $path $state]
+	if {![info exists pending_display($path)]} {
+		set pending_display($path) [list \
+			$old_m \
+			[lindex $file_states($path) 1]]
 	}
-	display_file_helper	$ui_workdir $path $icon_name $o $n
 
-	if {$new_m eq {__}} {
+	if {[lindex $file_states($path) 0] eq {__}} {
 		unset file_states($path)
 		catch {unset selected_paths($path)}
 	}
@@ -2163,7 +2217,9 @@ proc display_all_files {} {
 	global file_states file_lists
 	global last_clicked
 	global files_warning
+	global pending_display
 
+	array unset pending_display
 	$ui_index conf -state normal
 	$ui_workdir conf -state normal
 
@@ -2639,6 +2695,8 @@ proc find_next_diff {w path {lno {}} {mmask {}}} {
 	global next_diff_p next_diff_w next_diff_i
 	global file_lists ui_index ui_workdir
 
+	flush_display_files
+
 	set flist $file_lists($w)
 	if {$lno eq {}} {
 		set lno [find_anchor_pos $flist $path]
@@ -2724,6 +2782,8 @@ proc toggle_or_diff {mode w args} {
 	global file_states file_lists current_diff_path ui_index ui_workdir
 	global last_clicked selected_paths
 
+	flush_display_files
+
 	if {$mode eq "click"} {
 		foreach {x y} $args break
 		set pos [split [$w index @$x,$y] .]
@@ -2824,6 +2884,8 @@ proc toggle_or_diff {mode w args} {
 proc add_one_to_selection {w x y} {
 	global file_lists last_clicked selected_paths
 
+	flush_display_files
+
 	set lno [lindex [split [$w index @$x,$y] .] 0]
 	set path [lindex $file_lists($w) [expr {$lno - 1}]]
 	if {$path eq {}} {
@@ -2853,6 +2915,8 @@ proc add_one_to_selection {w x y} {
 proc add_range_to_selection {w x y} {
 	global file_lists last_clicked selected_paths
 
+	flush_display_files
+
 	if {[lindex $last_clicked 0] ne $w} {
 		toggle_or_diff click $w $x $y
 		return
@@ -3178,6 +3242,23 @@ proc commit_btn_caption {} {
 			-command("merge::reset_hard");
 		"lappend disable_on_lock "
 			"[list .mbar.merge entryconf [.mbar.merge index last] -state]"_tcl;
+		mbarmerge << add(separator);
+		mbarmerge << add(command) -menulabel(mc("Use Local Version For Selected"))
+			-command("merge_resolve_selection 2"s);
+		"lappend disable_on_lock "
+			"[list .mbar.merge entryconf [.mbar.merge index last] -state]"_tcl;
+		mbarmerge << add(command) -menulabel(mc("Use Remote Version For Selected"))
+			-command("merge_resolve_selection 3"s);
+		"lappend disable_on_lock "
+			"[list .mbar.merge entryconf [.mbar.merge index last] -state]"_tcl;
+		mbarmerge << add(command) -menulabel(mc("Use Local Version For Matching Files..."))
+			-command("merge_resolve_matching 2"s);
+		"lappend disable_on_lock "
+			"[list .mbar.merge entryconf [.mbar.merge index last] -state]"_tcl;
+		mbarmerge << add(command) -menulabel(mc("Use Remote Version For Matching Files..."))
+			-command("merge_resolve_matching 3"s);
+		"lappend disable_on_lock "
+			"[list .mbar.merge entryconf [.mbar.merge index last] -state]"_tcl;
 	}
 
 	// -- Transport Menu
@@ -3589,7 +3670,7 @@ trace add variable current_diff_path write trace_current_diff_path
 		-font("font_diff"s)
 		-takefocus(1) -highlightthickness(1)
 		-xscrollcommand(".vpane.lower.diff.body.sbx set"s)
-		-yscrollcommand(".vpane.lower.diff.body.sby set"s)
+		-yscrollcommand("diff_yscroll .vpane.lower.diff.body.sby"s)
 		-state(disabled);
 	"catch {$ui_diff configure -tabstyle wordprocessor}"_tcl;
 	scrollbar(".vpane.lower.diff.body.sbx"s) -orient(horizontal)
@@ -3651,6 +3732,10 @@ trace add variable current_diff_path write trace_current_diff_path
 		-foreground("orange"s)
 		-font("font_diffbold"s);
 
+	ui_diff << tag(configure, "d_hunksel"s) -background("#fff5d0"s);
+	ui_diff << tag(configure, "d_wdel"s) -background("#ffd8d8"s);
+	ui_diff << tag(configure, "d_wadd"s) -background("#d4f4d4"s);
+
 	ui_diff << tag(raise, "sel"s);
 
 	// -- Diff Body Context Menu
@@ -3719,6 +3804,22 @@ trace add variable current_diff_path write trace_current_diff_path
 	std::string ui_diff_applyline = eval(ctxm + " index last"s);
 	add_diff_actions_index_last(ctxm);
 	ctxm << add(separator);
+	ctxm << add(command)
+		-menulabel(mc("Select/Deselect Hunk"))
+		-command("toggle_hunk_selection $cursorX $cursorY"s);
+	std::string ui_diff_togglehunk = eval(ctxm + " index last"s);
+	add_diff_actions_index_last(ctxm);
+	ctxm << add(command)
+		-menulabel(mc("Select Hunks Containing Selected Text"))
+		-command("select_hunks_containing_selection"s);
+	std::string ui_diff_findhunks = eval(ctxm + " index last"s);
+	add_diff_actions_index_last(ctxm);
+	ctxm << add(command)
+		-menulabel(mc("Apply/Reverse Selected Hunks"))
+		-command("apply_hunk_selection"s);
+	std::string ui_diff_applyhunks = eval(ctxm + " index last"s);
+	add_diff_actions_index_last(ctxm);
+	ctxm << add(separator);
 	ctxm << add(command)
 		-menulabel(mc("Show Less Context"))
 		-command("show_less_context"s);
@@ -3749,6 +3850,14 @@ trace add variable current_diff_path write trace_current_diff_path
 		-menulabel(mc("Revert To Base"))
 		-command("merge_resolve_one 1"s);
 	add_diff_actions_index_last(ctxmmg);
+	ctxmmg << add(command)
+		-menulabel(mc("Use Remote Version For Selected"))
+		-command("merge_resolve_selection 3"s);
+	add_diff_actions_index_last(ctxmmg);
+	ctxmmg << add(command)
+		-menulabel(mc("Use Local Version For Selected"))
+		-command("merge_resolve_selection 2"s);
+	add_diff_actions_index_last(ctxmmg);
 	ctxmmg << add(separator);
 	ctxmmg << add(command)
 		-menulabel(mc("Show Less Context"))
@@ -3813,7 +3922,8 @@ proc has_textconv {path} {
 			tk_popup(ctxmsm, X, Y);
 		} else {
 			bool has_range = !"$::ui_diff tag nextrange sel 0.0"_tcls.empty();
-			std::string l, st, t;
+			bool has_hunks = !"::diff_hunk_selection"_tclvs.empty();
+			std::string l, st, t, h;
 			if (ui_index == "::current_diff_side"_tclvs) {
 				l = mc("Unstage Hunk From Commit");
 				if (has_range) {
@@ -3821,6 +3931,7 @@ proc has_textconv {path} {
 				} else {
 					t = mc("Unstage Line From Commit");
 				}
+				h = mc("Unstage Selected Hunks From Commit");
 			} else {
 				l = mc("Stage Hunk For Commit");
 				if (has_range) {
@@ -3828,6 +3939,7 @@ proc has_textconv {path} {
 				} else {
 					t = mc("Stage Line For Commit");
 				}
+				h = mc("Stage Selected Hunks For Commit");
 			}
 			if ("::is_3way_diff"_tclvi
 				|| "current_diff_path"_tclvs.empty()
@@ -3842,6 +3954,11 @@ proc has_textconv {path} {
 			}
 			ctxm << entryconfigure(ui_diff_applyhunk) -state(s) -menulabel(l);
 			ctxm << entryconfigure(ui_diff_applyline) -state(s) -menulabel(t);
+			ctxm << entryconfigure(ui_diff_togglehunk) -state(st);
+			ctxm << entryconfigure(ui_diff_findhunks)
+				-state(has_range ? st : "disabled"s);
+			ctxm << entryconfigure(ui_diff_applyhunks)
+				-state(has_hunks ? st : "disabled"s) -menulabel(h);
 			tk_popup(ctxm, X, Y);
 		}
 	};
@@ -7,16 +7,22 @@ std::string lib_blame = R"tcl(
 class blame {
 
 image create photo ::blame::img_back_arrow -data {R0lGODlhGAAYAIUAAPwCBEzKXFTSZIz+nGzmhGzqfGTidIT+nEzGXHTqhGzmfGzifFzadETCVES+VARWDFzWbHzyjAReDGTadFTOZDSyRDyyTCymPARaFGTedFzSbDy2TCyqRCyqPARaDAyCHES6VDy6VCyiPAR6HCSeNByWLARyFARiDARqFGTifARiFAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAACH5BAEAAAAALAAAAAAYABgAAAajQIBwSCwaj8ikcsk0BppJwRPqHEypQwHBis0WDAdEFyBIKBaMAKLBdjQeSkFBYTBAIvgEoS6JmhUTEwIUDQ4VFhcMGEhyCgoZExoUaxsWHB0THkgfAXUGAhoBDSAVFR0XBnCbDRmgog0hpSIiDJpJIyEQhBUcJCIlwA22SSYVogknEg8eD82qSigdDSknY0IqJQXPYxIl1dZCGNvWw+Dm510GQQAh/mhDcmVhdGVkIGJ5IEJNUFRvR0lGIFBybyB2ZXJzaW9uIDIuNQ0KqSBEZXZlbENvciAxOTk3LDE5OTguIEFsbCByaWdodHMgcmVzZXJ2ZWQuDQpodHRwOi8vd3d3LmRldmVsY29yLmNvbQA7}
+image create photo ::blame::img_forward_arrow
+::blame::img_forward_arrow copy ::blame::img_back_arrow -subsample -1 1
 
 # Persistent data (survives loads)
 #
 field history {}; # viewer history: {commit path}
-field header    ; # array commit,key -> header field
+field future  {}; # entries left by going back, nearest last
+field states  {}; # viewer states kept in memory, oldest first
+field state_data ; # array state -> {text lines cache_key}
+field state_seq 0; # for naming states
 
 # Tk UI control paths
 #
 field w          ; # top window in this viewer
 field w_back     ; # our back button
+field w_forward  ; # our forward button
 field w_path     ; # label showing the current file path
 field w_columns  ; # list of all column widgets in the viewer
 field w_line     ; # text column: all line numbers
@@ -39,25 +45,37 @@ variable group_colors {
 	#ececec
 }
 
+# Files longer than this many lines are annotated in two runs: the lines
+# the user looks at first, then all others. Scrolling to lines that are
+# not annotated yet starts over from there.
+#
+variable blame_chunk 1000
+
+# Number of viewer states that are kept in memory, so that going back and
+# forward does not have to annotate the file again
+#
+variable history_states 8
+
 # Current blame data; cleared/reset on each load
 #
 field commit               ; # input commit to blame
 field path                 ; # input filename to view in $commit
 
-field current_fd        {} ; # background process running
+field current_fd        {} ; # file or diff being read
+field blame_fd             ; # array column -> git blame feeding it
 field highlight_line    -1 ; # current line selected
 field highlight_column  {} ; # current commit column selected
 field highlight_commit  {} ; # sha1 of commit selected
 
 field total_lines       0  ; # total length of file
-field blame_lines       0  ; # number of lines computed
-field amov_data            ; # list of {commit origfile origline}
-field asim_data            ; # list of {commit origfile origline}
-
-field r_commit             ; # commit currently being parsed
-field r_orig_line          ; # original line number
-field r_final_line         ; # final line number
-field r_line_count         ; # lines in this region
+field blame_lines          ; # array column -> lines computed
+field blame_todo           ; # array column -> line ranges still to do
+field blame_piece          ; # array column -> view, rest, or all lines running
+field blame_replan      {} ; # timer to look at the view after scrolling
+field blame_opts           ; # array column -> git blame options
+field cache_key         {} ; # what is blamed, for the result cache
+field amov_data            ; # blame_data of move/copy tracking column
+field asim_data            ; # blame_data of simple annotation column
 
 field tooltip_wm        {} ; # Current tooltip toplevel, if open
 field tooltip_t         {} ; # Text widget in $tooltip_wm
@@ -72,6 +90,9 @@ constructor new {i_commit i_path i_jump} {
 	set commit $i_commit
 	set path   $i_path
 
+	set amov_data [blame_data::new ${__this}::amov]
+	set asim_data [blame_data::new ${__this}::asim]
+
 	make_toplevel top w
 	wm title $top [mc "%s (%s): File Viewer" [appname] [reponame]]
 
@@ -95,7 +116,21 @@ constructor new {i_commit i_path i_jump} {
 		-activebackground gold
 	bind $w_back <Button-1> "
 		if {\[$w_back cget -state\] eq {normal}} {
-			[cb _history_menu]
+			[cb _history_menu back]
+		}
+		"
+	set w_forward $w.header.commit_f
+	tlabel $w_forward \
+		-image ::blame::img_forward_arrow \
+		-borderwidth 0 \
+		-relief flat \
+		-state disabled \
+		-background gold \
+		-foreground black \
+		-activebackground gold
+	bind $w_forward <Button-1> "
+		if {\[$w_forward cget -state\] eq {normal}} {
+			[cb _history_menu forward]
 		}
 		"
 	tlabel $w.header.commit \
@@ -118,6 +153,7 @@ constructor new {i_commit i_path i_jump} {
 		-justify left
 	pack $w.header.commit_l -side left
 	pack $w_back -side left
+	pack $w_forward -side left
 	pack $w.header.commit -side left
 	pack $w_path -fill x -side right
 	pack $w.header.path_l -side right
@@ -169,7 +205,7 @@ constructor new {i_commit i_path i_jump} {
 	$w_amov tag conf prior_commit -foreground blue -underline 1
 	$w_amov tag bind prior_commit \
 		<Button-1> \
-		"[cb _load_commit $w_amov @amov_data @%x,%y];break"
+		"[cb _load_commit $w_amov $amov_data @%x,%y];break"
 
 	set w_asim $w.file_pane.out.asimple_t
 	text $w_asim \
@@ -189,7 +225,7 @@ constructor new {i_commit i_path i_jump} {
 	$w_asim tag conf prior_commit -foreground blue -underline 1
 	$w_asim tag bind prior_commit \
 		<Button-1> \
-		"[cb _load_commit $w_asim @asim_data @%x,%y];break"
+		"[cb _load_commit $w_asim $asim_data @%x,%y];break"
 
 	set w_file $w.file_pane.out.file_t
 	text $w_file \
@@ -318,8 +354,12 @@ constructor new {i_commit i_path i_jump} {
 		$i tag raise sel
 
 		$i conf -cursor $cursor_ptr
+		set scrolled [list ::searchbar::scrolled $finder]
+		if {$i eq $w_file} {
+			append scrolled \n[cb _scrolled]
+		}
 		$i conf -yscrollcommand \
-			"[list ::searchbar::scrolled $finder]
+			"$scrolled
 			 [list many2scrollbar $w_columns yview $w.file_pane.out.sby]"
 		bind $i <Button-1> "
 			[cb _hide_tooltip]
@@ -422,23 +462,31 @@ method _kill {} {
 		catch {close $current_fd}
 		set current_fd {}
 	}
+	foreach {cur_w fd} [array get blame_fd] {
+		kill_file_process $fd
+		catch {close $fd}
+	}
+	array unset blame_fd
+	array unset blame_lines
+	array unset blame_todo
+	array unset blame_piece
+	after cancel $blame_replan
+	set blame_replan {}
 }
 
-method _load {jump} {
-	variable group_colors
-
+method _reset {} {
 	_hide_tooltip $this
 
-	if {$total_lines != 0 || $current_fd ne {}} {
+	if {$total_lines != 0 || $current_fd ne {}
+		|| [array size blame_fd] > 0} {
 		_kill $this
 
 		foreach i $w_columns {
 			$i conf -state normal
 			$i delete 0.0 end
-			foreach g [$i tag names] {
-				if {[regexp {^g[0-9a-f]{40}$} $g]} {
-					$i tag delete $g
-				}
+			set tags [lsearch -all -inline -regexp [$i tag names] {^g[0-9a-f]+$}]
+			if {$tags ne {}} {
+				$i tag delete {*}$tags
 			}
 			$i conf -state disabled
 		}
@@ -453,18 +501,20 @@ method _load {jump} {
 		set total_lines 0
 	}
 
-	if {$history eq {}} {
-		$w_back conf -state disabled
-	} else {
-		$w_back conf -state normal
+	foreach {b l} [list $w_back $history $w_forward $future] {
+		if {$l eq {}} {
+			$b conf -state disabled
+		} else {
+			$b conf -state normal
+		}
 	}
 
-	# Index 0 is always empty.  There is never line 0 as
-	# we use only 1 based lines, as that matches both with
-	# git-blame output and with Tk's text widget.
-	#
-	set amov_data [list [list]]
-	set asim_data [list [list]]
+	$amov_data resize 0
+	$asim_data resize 0
+}
+
+method _load {jump} {
+	_reset $this
 
 	$status show [mc "Reading %s..." "$commit:[escape_path $path]"]
 	$w_path conf -text [escape_path $path]
@@ -477,12 +527,16 @@ method _load {jump} {
 			set do_textconv 1
 		}
 	}
+	if {$commit eq {} && $do_textconv eq 0} {
+		# The file is at hand; take it in one go.
+		#
+		foreach {n text} [read_file_text $path [get_path_encoding $path]] break
+		_append_text $this $text $n
+		_file_loaded $this $jump
+		return
+	}
 	if {$commit eq {}} {
-		if {$do_textconv ne 0} {
-			set fd [open_cmd_pipe $textconv $path]
-		} else {
-			set fd [open $path r]
-		}
+		set fd [open_cmd_pipe $textconv $path]
 		fconfigure $fd -eofchar {}
 	} else {
 		if {$do_textconv ne 0} {
@@ -493,23 +547,30 @@ method _load {jump} {
 	}
 	fconfigure $fd \
 		-blocking 0 \
-		-translation lf \
-		-encoding [get_path_encoding $path]
-	fileevent $fd readable [cb _read_file $fd $jump]
+		-translation binary
+	fileevent $fd readable [cb _read_file $fd \
+		[get_path_encoding $path] $jump]
 	set current_fd $fd
 }
 
-method _history_menu {} {
-	set m $w.backmenu
+method _history_menu {dir} {
+	if {$dir eq {back}} {
+		set entries $history
+		set b $w_back
+	} else {
+		set entries $future
+		set b $w_forward
+	}
+	set m $w.${dir}menu
 	if {[winfo exists $m]} {
 		$m delete 0 end
 	} else {
 		menu $m -tearoff 0
 	}
 
-	for {set i [expr {[llength $history] - 1}]
+	for {set i [expr {[llength $entries] - 1}]
 		} {$i >= 0} {incr i -1} {
-		set e [lindex $history $i]
+		set e [lindex $entries $i]
 		set c [lindex $e 0]
 		set f [lindex $e 1]
 
@@ -520,55 +581,128 @@ method _history_menu {} {
 		} else {
 			set t $c
 		}
-		if {![catch {set summary $header($c,summary)}]} {
+		if {$c ne {}} {
+			set summary [commit_store::get $c summary]
+		} else {
+			set summary {}
+		}
+		if {$summary ne {}} {
 			append t " $summary"
 			if {[string length $t] > 70} {
 				set t [string range $t 0 66]...
 			}
 		}
 
-		$m add command -label $t -command [cb _goback $i]
+		$m add command -label $t -command [cb _go$dir $i]
 	}
-	set X [winfo rootx $w_back]
-	set Y [expr {[winfo rooty $w_back] + [winfo height $w_back]}]
+	set X [winfo rootx $b]
+	set Y [expr {[winfo rooty $b] + [winfo height $b]}]
 	tk_popup $m $X $Y
 }
 
 method _goback {i} {
+	lappend future [_location $this]
+	for {set j [expr {[llength $history] - 1}]} {$j > $i} {incr j -1} {
+		lappend future [lindex $history $j]
+	}
 	set dat [lindex $history $i]
 	set history [lrange $history 0 [expr {$i - 1}]]
-	set commit [lindex $dat 0]
-	set path [lindex $dat 1]
-	_load $this [lrange $dat 2 5]
+	_restore $this $dat
 }
 
-method _read_file {fd jump} {
-	if {$fd ne $current_fd} {
-		catch {close $fd}
-		return
+method _goforward {i} {
+	lappend history [_location $this]
+	for {set j [expr {[llength $future] - 1}]} {$j > $i} {incr j -1} {
+		lappend history [lindex $future $j]
 	}
+	set dat [lindex $future $i]
+	set future [lrange $future 0 [expr {$i - 1}]]
+	_restore $this $dat
+}
 
-	foreach i $w_columns {$i conf -state normal}
-	while {[gets $fd line] >= 0} {
-		regsub "\r\$" $line {} line
-		incr total_lines
-		lappend amov_data {}
-		lappend asim_data {}
+# Describes what is shown as a history entry {commit path highlight_column
+# highlight_line xview yview state}. The state is only saved if the file
+# is completely annotated.
+#
+method _location {} {
+	return [list \
+		$commit $path \
+		$highlight_column \
+		$highlight_line \
+		[lindex [$w_file xview] 0] \
+		[lindex [$w_file yview] 0] \
+		[_save_state $this] \
+		]
+}
 
-		if {$total_lines > 1} {
-			foreach i $w_columns {$i insert end "\n"}
-		}
+method _save_state {} {
+	variable history_states
 
-		$w_line insert end "$total_lines" linenumber
-		$w_file insert end "$line"
+	if {$history_states <= 0 || $total_lines == 0
+		|| $current_fd ne {} || [array size blame_fd] > 0} {
+		return {}
 	}
 
-	set ln_wc [expr {[string length $total_lines] + 2}]
-	if {[$w_line cget -width] < $ln_wc} {
-		$w_line conf -width $ln_wc
+	set s ${__this}::state[incr state_seq]
+	$asim_data copy ${s}_asim
+	$amov_data copy ${s}_amov
+	set state_data($s) [list \
+		[$w_file get 1.0 end-1c] \
+		$total_lines \
+		$cache_key \
+		]
+	lappend states $s
+	while {[llength $states] > $history_states} {
+		_drop_state $this [lindex $states 0]
 	}
+	return $s
+}
 
-	foreach i $w_columns {$i conf -state disabled}
+method _drop_state {s} {
+	if {[info exists state_data($s)]} {
+		unset state_data($s)
+		rename ${s}_asim {}
+		rename ${s}_amov {}
+		set i [lsearch -exact $states $s]
+		set states [lreplace $states $i $i]
+	}
+}
+
+# Shows a history entry again. Its saved state is put back without
+# running git; entries without one are loaded afresh.
+#
+method _restore {dat} {
+	foreach {commit path col lno xv yv s} $dat break
+	if {$s eq {} || ![info exists state_data($s)]} {
+		_load $this [list $col $lno $xv $yv]
+		return
+	}
+
+	_reset $this
+	$w_path conf -text [escape_path $path]
+	foreach {text n cache_key} $state_data($s) break
+	_append_text $this $text $n
+	update
+
+	set highlight_column $col
+	set highlight_line $lno
+	$w_file xview moveto $xv
+	$w_file yview moveto $yv
+
+	_render_regions $this $w_asim $asim_data [$asim_data assign ${s}_asim]
+	_render_regions $this $w_amov $amov_data [$amov_data assign ${s}_amov]
+	_drop_state $this $s
+	$status stop [mc "Annotation complete."]
+}
+
+method _read_file {fd enc jump} {
+	if {$fd ne $current_fd} {
+		catch {close $fd}
+		return
+	}
+
+	foreach {n text} [read_text $fd $enc] break
+	_append_text $this $text $n
 
 	if {[eof $fd]} {
 		fconfigure $fd -blocking 1; # enable error reporting on close
@@ -576,29 +710,123 @@ method _read_file {fd jump} {
 			tk_messageBox -icon error -title [mc Error] \
 				-message $err
 		}
+		set current_fd {}
+		_file_loaded $this $jump
+	}
+} ifdeleted { catch {close $fd} }
 
-		# If we don't force Tk to update the widgets *right now*
-		# none of our jump commands will cause a change in the UI.
-		#
-		update
+# Starts the annotation once the whole file is shown.
+#
+method _file_loaded {jump} {
+	# If we don't force Tk to update the widgets *right now*
+	# none of our jump commands will cause a change in the UI.
+	#
+	update
 
-		if {[llength $jump] == 1} {
-			set highlight_line [lindex $jump 0]
-			$w_file see "$highlight_line.0"
-		} elseif {[llength $jump] == 4} {
-			set highlight_column [lindex $jump 0]
-			set highlight_line [lindex $jump 1]
-			$w_file xview moveto [lindex $jump 2]
-			$w_file yview moveto [lindex $jump 3]
-		}
+	if {[llength $jump] == 1} {
+		set highlight_line [lindex $jump 0]
+		$w_file see "$highlight_line.0"
+	} elseif {[llength $jump] == 4} {
+		set highlight_column [lindex $jump 0]
+		set highlight_line [lindex $jump 1]
+		$w_file xview moveto [lindex $jump 2]
+		$w_file yview moveto [lindex $jump 3]
+	}
 
-		_exec_blame $this $w_asim @asim_data \
+	# Both passes run side by side; the simple one is usually
+	# done long before the copy/move detection. Results of
+	# earlier runs are taken from the cache.
+	#
+	set cache_key [_blame_cache_key $this]
+	if {![_cache_load $this $w_asim $asim_data [list]]} {
+		_exec_blame $this $w_asim $asim_data \
 			[list] \
 			[mc "Loading copy/move tracking annotations..."]
 	}
-} ifdeleted { catch {close $fd} }
+
+	# Switches for original location detection
+	set threshold [get_config gui.copyblamethreshold]
+	set original_options [list "-C$threshold"]
+
+	if {![is_config_true gui.fastcopyblame]} {
+		# thorough copy search; insert before the threshold
+		set original_options [linsert $original_options 0 -C]
+	}
+	if {[git-version >= 1.5.3]} {
+		lappend original_options -w ; # ignore indentation changes
+	}
+
+	if {![_cache_load $this $w_amov $amov_data $original_options]} {
+		_exec_blame $this $w_amov $amov_data \
+			$original_options \
+			[mc "Loading original location annotations..."]
+	}
+	if {[array size blame_fd] == 0} {
+		$status stop [mc "Annotation complete."]
+	}
+}
+
+# Appends text, n lines of the file without the final newline, to the
+# file column, and grows the other columns along.
+#
+method _append_text {text n} {
+	if {$n > 0} {
+		set nl [expr {$total_lines > 0 ? "\n" : {}}]
+		set numbers [blame_data::numbers [expr {$total_lines + 1}] $n]
+		incr total_lines $n
+
+		foreach i $w_columns {
+			$i conf -state normal
+			if {$i eq $w_line} {
+				$i insert end $nl {} $numbers linenumber
+			} elseif {$i eq $w_file} {
+				$i insert end $nl$text
+			} else {
+				$i insert end $nl[string repeat "\n" [expr {$n - 1}]]
+			}
+		}
+	}
+	$amov_data resize $total_lines
+	$asim_data resize $total_lines
+
+	set ln_wc [expr {[string length $total_lines] + 2}]
+	if {[$w_line cget -width] < $ln_wc} {
+		$w_line conf -width $ln_wc
+	}
+
+	foreach i $w_columns {$i conf -state disabled}
+}
 
 method _exec_blame {cur_w cur_d options cur_s} {
+	variable blame_chunk
+
+	if {[array size blame_fd] == 0} {
+		array unset blame_lines
+		$status start \
+			$cur_s \
+			[mc "lines annotated"]
+	}
+	set blame_lines($cur_w) 0
+	set blame_opts($cur_w) $options
+
+	# The copy/move detection is not split, since copied blocks cut at
+	# the edge of a piece may fall below its score threshold. Multiple
+	# -L options need git 1.8.4.
+	#
+	if {$total_lines > $blame_chunk
+		&& [lsearch -exact $options -L] == -1
+		&& [lsearch -glob $options -C*] == -1
+		&& [git-version >= 1.8.4]} {
+		set blame_todo($cur_w) [list [list 1 $total_lines]]
+		_next_blame_range $this $cur_w $cur_d view
+	} else {
+		set blame_todo($cur_w) [list]
+		set blame_piece($cur_w) all
+		_start_blame $this $cur_w $cur_d $options
+	}
+}
+
+method _start_blame {cur_w cur_d options} {
 	lappend options --incremental --encoding=utf-8
 	if {$commit eq {}} {
 		lappend options --contents $path
@@ -607,235 +835,401 @@ method _exec_blame {cur_w cur_d options cur_s} {
 	}
 	lappend options -- $path
 	set fd [eval git_read --nice blame $options]
-	fconfigure $fd -blocking 0 -translation lf -encoding utf-8
+	fconfigure $fd -blocking 0 -translation binary
 	fileevent $fd readable [cb _read_blame $fd $cur_w $cur_d]
-	set current_fd $fd
-	set blame_lines 0
+	set blame_fd($cur_w) $fd
+}
+
+# Runs git blame on the next piece of the file that is still to do for
+# the column. The view piece covers the visible lines, centered on the
+# selected line if it is visible. The rest piece covers all remaining
+# lines with one -L option per range, so that git goes through the
+# history only once more.
+#
+method _next_blame_range {cur_w cur_d piece} {
+	set blame_piece($cur_w) $piece
+	if {$piece eq {rest}} {
+		set ranges [list]
+		foreach r $blame_todo($cur_w) {
+			lappend ranges -L [join $r ,]
+		}
+		set blame_todo($cur_w) [list]
+		_start_blame $this $cur_w $cur_d \
+			[concat $blame_opts($cur_w) $ranges]
+		return
+	}
+
+	set top [lindex [split [$w_file index @0,0] .] 0]
+	set bot [lindex [split [$w_file index @0,[winfo height $w_file]] .] 0]
+	if {$highlight_line >= $top && $highlight_line <= $bot} {
+		set mid $highlight_line
+	} else {
+		set mid [expr {($top + $bot) / 2}]
+	}
+	set size [expr {$bot - $top + 1}]
+
+	set best -1
+	set best_dist {}
+	set i 0
+	foreach r $blame_todo($cur_w) {
+		foreach {f l} $r break
+		if {$mid < $f} {
+			set dist [expr {$f - $mid}]
+		} elseif {$mid > $l} {
+			set dist [expr {$mid - $l}]
+		} else {
+			set dist 0
+		}
+		if {$best < 0 || $dist < $best_dist} {
+			set best $i
+			set best_dist $dist
+		}
+		incr i
+	}
+
+	foreach {f l} [lindex $blame_todo($cur_w) $best] break
+	set a [expr {$mid - $size / 2}]
+	if {$a > $l - $size + 1} {
+		set a [expr {$l - $size + 1}]
+	}
+	if {$a < $f} {
+		set a $f
+	}
+	set b [expr {$a + $size - 1}]
+	if {$b > $l} {
+		set b $l
+	}
 
-	$status start \
-		$cur_s \
-		[mc "lines annotated"]
+	set rest [list]
+	if {$f < $a} {
+		lappend rest [list $f [expr {$a - 1}]]
+	}
+	if {$b < $l} {
+		lappend rest [list [expr {$b + 1}] $l]
+	}
+	set blame_todo($cur_w) [lreplace $blame_todo($cur_w) $best $best {*}$rest]
+
+	_start_blame $this $cur_w $cur_d \
+		[concat $blame_opts($cur_w) [list -L $a,$b]]
 }
 
-method _read_blame {fd cur_w cur_d} {
-	upvar #0 $cur_d line_data
-	variable group_colors
+method _scrolled {} {
+	after cancel $blame_replan
+	set blame_replan [after 200 [cb _replan]]
+}
 
-	if {$fd ne $current_fd} {
+# Once the user has scrolled to lines that are not annotated yet, the
+# run of the rest piece is stopped, and the lines in view are annotated
+# first again.
+#
+method _replan {} {
+	set blame_replan {}
+	set top [lindex [split [$w_file index @0,0] .] 0]
+	set bot [lindex [split [$w_file index @0,[winfo height $w_file]] .] 0]
+	foreach {cur_w fd} [array get blame_fd] {
+		if {$blame_piece($cur_w) ne {rest}} continue
+		if {$cur_w eq $w_amov} {
+			set cur_d $amov_data
+		} else {
+			set cur_d $asim_data
+		}
+		if {[$cur_d missing $top $bot] eq {}} continue
+
+		kill_file_process $fd
 		catch {close $fd}
-		return
+		unset blame_fd($cur_w)
+		set blame_todo($cur_w) [$cur_d missing 1 $total_lines]
+		_next_blame_range $this $cur_w $cur_d view
 	}
+}
 
-	$cur_w conf -state normal
-	while {[gets $fd line] >= 0} {
-		if {[regexp {^([a-z0-9]{40}) (\d+) (\d+) (\d+)$} $line line \
-			cmit original_line final_line line_count]} {
-			set r_commit     $cmit
-			set r_orig_line  $original_line
-			set r_final_line $final_line
-			set r_line_count $line_count
-		} elseif {[string match {filename *} $line]} {
-			set file [string range $line 9 end]
-			set n    $r_line_count
-			set lno  $r_final_line
-			set oln  $r_orig_line
-			set cmit $r_commit
-
-			if {[regexp {^0{40}$} $cmit]} {
-				set commit_abbr work
-				set commit_type curr_commit
-			} elseif {$cmit eq $commit} {
-				set commit_abbr this
-				set commit_type curr_commit
-			} else {
-				set commit_type prior_commit
-				set commit_abbr [string range $cmit 0 3]
-			}
+# Shows the progress of all passes that were started since the status
+# bar was last idle as one meter.
+#
+method _blame_progress {} {
+	set have 0
+	foreach {cur_w n} [array get blame_lines] {
+		incr have $n
+	}
+	$status update $have \
+		[expr {$total_lines * [array size blame_lines]}]
+}
 
-			set author_abbr {}
-			set a_name {}
-			catch {set a_name $header($cmit,author)}
-			while {$a_name ne {}} {
-				if {$author_abbr ne {}
-					&& [string index $a_name 0] eq {'}} {
-					regsub {^'[^']+'\s+} $a_name {} a_name
-				}
-				if {![regexp {^([[:upper:]])} $a_name _a]} break
-				append author_abbr $_a
-				unset _a
-				if {![regsub \
-					{^[[:upper:]][^\s]*\s+} \
-					$a_name {} a_name ]} break
-			}
-			if {$author_abbr eq {}} {
-				set author_abbr { |}
-			} else {
-				set author_abbr [string range $author_abbr 0 3]
-			}
-			unset a_name
-
-			set first_lno $lno
-			while {
-			   $first_lno > 1
-			&& $cmit eq [lindex $line_data [expr {$first_lno - 1}] 0]
-			&& $file eq [lindex $line_data [expr {$first_lno - 1}] 1]
-			} {
-				incr first_lno -1
-			}
+method _read_blame {fd cur_w cur_d} {
+	if {![info exists blame_fd($cur_w)] || $blame_fd($cur_w) ne $fd} {
+		catch {close $fd}
+		return
+	}
 
-			set color {}
-			if {$first_lno < $lno} {
-				foreach g [$w_file tag names $first_lno.0] {
-					if {[regexp {^color[0-9]+$} $g]} {
-						set color $g
-						break
-					}
-				}
-			} else {
-				set i [lsort [concat \
-					[$w_file tag names "[expr {$first_lno - 1}].0"] \
-					[$w_file tag names "[expr {$lno + $n}].0"] \
-					]]
-				for {set g 0} {$g < [llength $group_colors]} {incr g} {
-					if {[lsearch -sorted -exact $i color$g] == -1} {
-						set color color$g
-						break
-					}
-				}
-			}
-			if {$color eq {}} {
-				set color color0
-			}
+	incr blame_lines($cur_w) [_render_regions $this $cur_w $cur_d \
+		[$cur_d parse [read_lines $fd utf-8]]]
 
-			while {$n > 0} {
-				set lno_e "$lno.0 lineend + 1c"
-				if {[lindex $line_data $lno] ne {}} {
-					set g [lindex $line_data $lno 0]
-					foreach i $w_columns {
-						$i tag remove g$g $lno.0 $lno_e
-					}
-				}
-				lset line_data $lno [list $cmit $file $oln]
+	if {[eof $fd]} {
+		close $fd
+		if {$blame_todo($cur_w) ne {}} {
+			_next_blame_range $this $cur_w $cur_d rest
+			_blame_progress $this
+			return
+		}
+		if {$blame_lines($cur_w) == $total_lines} {
+			_cache_store $this $cur_w $cur_d
+		}
+		unset blame_fd($cur_w)
+		if {[array size blame_fd] == 0} {
+			array unset blame_lines
+			$status stop [mc "Annotation complete."]
+			return
+		}
+	}
+	_blame_progress $this
+} ifdeleted { catch {close $fd} }
 
-				$cur_w delete $lno.0 "$lno.0 lineend"
-				if {$lno == $first_lno} {
-					$cur_w insert $lno.0 $commit_abbr $commit_type
-				} elseif {$lno == [expr {$first_lno + 1}]} {
-					$cur_w insert $lno.0 $author_abbr author_abbr
-				} else {
-					$cur_w insert $lno.0 { |}
-				}
+# Shows the regions in the column, and returns the number of lines
+# they cover.
+#
+method _render_regions {cur_w cur_d regions} {
+	variable group_colors
 
-				foreach i $w_columns {
-					if {$cur_w eq $w_amov} {
-						for {set g 0} \
-							{$g < [llength $group_colors]} \
-							{incr g} {
-							$i tag remove color$g $lno.0 $lno_e
-						}
-						$i tag add $color $lno.0 $lno_e
-					}
-					$i tag add g$cmit $lno.0 $lno_e
-				}
+	# Group colors are applied once for all regions that were read
+	# in this round, as a single tag operation per color and column.
+	#
+	set recolor [list]
+	set done 0
 
-				if {$highlight_column eq $cur_w} {
-					if {$highlight_line == -1
-					 && [lindex [$w_file yview] 0] == 0} {
-						$w_file see $lno.0
-						set highlight_line $lno
-					}
-					if {$highlight_line == $lno} {
-						_showcommit $this $cur_w $lno
-					}
-				}
+	$cur_w conf -state normal
+	foreach region $regions {
+		foreach {lno n first_lno end_lno cmit file olds} $region break
+
+		if {[regexp {^0+$} $cmit]} {
+			set commit_abbr work
+			set commit_type curr_commit
+		} elseif {$cmit eq $commit} {
+			set commit_abbr this
+			set commit_type curr_commit
+		} else {
+			set commit_type prior_commit
+			set commit_abbr [string range $cmit 0 3]
+		}
 
-				incr n -1
-				incr lno
-				incr oln
-				incr blame_lines
+		set author_abbr {}
+		set a_name [commit_store::get $cmit author]
+		while {$a_name ne {}} {
+			if {$author_abbr ne {}
+				&& [string index $a_name 0] eq {'}} {
+				regsub {^'[^']+'\s+} $a_name {} a_name
 			}
+			if {![regexp {^([[:upper:]])} $a_name _a]} break
+			append author_abbr $_a
+			unset _a
+			if {![regsub \
+				{^[[:upper:]][^\s]*\s+} \
+				$a_name {} a_name ]} break
+		}
+		if {$author_abbr eq {}} {
+			set author_abbr { |}
+		} else {
+			set author_abbr [string range $author_abbr 0 3]
+		}
+		unset a_name
 
-			while {
-			   $cmit eq [lindex $line_data $lno 0]
-			&& $file eq [lindex $line_data $lno 1]
-			} {
-				$cur_w delete $lno.0 "$lno.0 lineend"
-
-				if {$lno == $first_lno} {
-					$cur_w insert $lno.0 $commit_abbr $commit_type
-				} elseif {$lno == [expr {$first_lno + 1}]} {
-					$cur_w insert $lno.0 $author_abbr author_abbr
-				} else {
-					$cur_w insert $lno.0 { |}
-				}
+		# Rewrite the column text of the region and of the rest
+		# of the run it joined in one go.
+		#
+		set text [list]
+		set i $lno
+		if {$i == $first_lno} {
+			lappend text $commit_abbr $commit_type
+			incr i
+		}
+		if {$i == $first_lno + 1 && $i < $end_lno} {
+			if {$i > $lno} {
+				lappend text "\n" {}
+			}
+			lappend text $author_abbr author_abbr
+			incr i
+		}
+		if {$i < $end_lno} {
+			set rest [string repeat "\n |" [expr {$end_lno - $i}]]
+			if {$i == $lno} {
+				set rest [string range $rest 1 end]
+			}
+			lappend text $rest {}
+		}
+		$cur_w delete $lno.0 "[expr {$end_lno - 1}].0 lineend"
+		$cur_w insert $lno.0 {*}$text
 
-				if {$cur_w eq $w_amov} {
-					foreach i $w_columns {
-						for {set g 0} \
-							{$g < [llength $group_colors]} \
-							{incr g} {
-							$i tag remove color$g $lno.0 $lno_e
-						}
-						$i tag add $color $lno.0 $lno_e
-					}
-				}
+		# The rewritten text lost the tags that the other pass
+		# put on it.
+		#
+		if {$cur_w eq $w_asim} {
+			set other $amov_data
+		} else {
+			set other $asim_data
+		}
+		foreach {s e g color} [$other runs $lno $end_lno] {
+			$cur_w tag add g$g $s.0 $e.0
+			if {$cur_w eq $w_asim} {
+				$cur_w tag add color$color $s.0 $e.0
+			}
+		}
 
-				incr lno
+		set r_end [expr {$lno + $n}].0
+		foreach i $w_columns {
+			foreach g $olds {
+				$i tag remove g$g $lno.0 $r_end
 			}
+			$i tag add g$cmit $lno.0 $end_lno.0
+		}
+
+		if {$cur_w eq $w_amov} {
+			lappend recolor $lno.0 $end_lno.0
+		}
 
-		} elseif {[regexp {^([a-z-]+) (.*)$} $line line key data]} {
-			set header($r_commit,$key) $data
+		if {$highlight_column eq $cur_w} {
+			if {$highlight_line == -1
+			 && [lindex [$w_file yview] 0] == 0} {
+				$w_file see $lno.0
+				set highlight_line $lno
+			}
+			if {$highlight_line >= $lno
+			 && $highlight_line < $lno + $n} {
+				_showcommit $this $cur_w $highlight_line
+			}
 		}
+
+		incr done $n
 	}
 	$cur_w conf -state disabled
 
-	if {[eof $fd]} {
-		close $fd
-		if {$cur_w eq $w_asim} {
-			# Switches for original location detection
-			set threshold [get_config gui.copyblamethreshold]
-			set original_options [list "-C$threshold"]
-
-			if {![is_config_true gui.fastcopyblame]} {
-				# thorough copy search; insert before the threshold
-				set original_options [linsert $original_options 0 -C]
+	if {$recolor ne {}} {
+		# Runs may have grown together since their range was
+		# recorded, so their final color is looked up only now.
+		#
+		for {set g 0} {$g < [llength $group_colors]} {incr g} {
+			set colored($g) [list]
+		}
+		foreach {s e} $recolor {
+			lappend colored([$cur_d color [lindex [split $s .] 0]]) $s $e
+		}
+		foreach i $w_columns {
+			for {set g 0} {$g < [llength $group_colors]} {incr g} {
+				$i tag remove color$g {*}$recolor
 			}
-			if {[git-version >= 1.5.3]} {
-				lappend original_options -w ; # ignore indentation changes
+			for {set g 0} {$g < [llength $group_colors]} {incr g} {
+				if {$colored($g) ne {}} {
+					$i tag add color$g {*}$colored($g)
+				}
 			}
+		}
+	}
 
-			_exec_blame $this $w_amov @amov_data \
-				$original_options \
-				[mc "Loading original location annotations..."]
+	return $done
+}
+
+# Identifies what is blamed for the result cache: the commit, the path,
+# and the contents of the file, as well as the .mailmap and the revisions
+# to ignore, which change the result for the same history. Returns {} if
+# the result must not be cached.
+#
+method _blame_cache_key {} {
+	if {[get_config gui.blamecachesize] <= 0} {
+		return {}
+	}
+	if {[catch {
+		if {$commit eq {}} {
+			set key [list \
+				[git rev-parse --verify HEAD] \
+				[blame_data::file_digest $path]]
 		} else {
-			set current_fd {}
-			$status stop [mc "Annotation complete."]
+			set key [git rev-parse \
+				"$commit^{commit}" \
+				"$commit:$path"]
 		}
-	} else {
-		$status update $blame_lines $total_lines
+	}] || [lindex $key end] eq {}} {
+		return {}
+	}
+
+	set mailmap [list]
+	if {![is_bare]} {
+		lappend mailmap [blame_data::file_digest .mailmap]
+	}
+	set mailmap_file [get_config mailmap.file]
+	if {$mailmap_file ne {}} {
+		lappend mailmap [blame_data::file_digest $mailmap_file]
+	}
+	set mailmap_blob [get_config mailmap.blob]
+	if {$mailmap_blob eq {} && [is_bare]} {
+		set mailmap_blob HEAD:.mailmap
+	}
+	if {$mailmap_blob ne {}} {
+		catch {lappend mailmap [git rev-parse --verify -q $mailmap_blob]}
 	}
-} ifdeleted { catch {close $fd} }
 
-method _find_commit_bound {data_list start_idx delta} {
-	upvar #0 $data_list line_data
-	set pos $start_idx
-	set limit       [expr {[llength $line_data] - 1}]
-	set base_commit [lindex $line_data $pos 0]
+	set ignore [list]
+	foreach f [get_config blame.ignorerevsfile] {
+		lappend ignore $f [blame_data::file_digest $f]
+	}
 
-	while {$pos > 0 && $pos < $limit} {
-		set new_pos [expr {$pos + $delta}]
-		if {[lindex $line_data $new_pos 0] ne $base_commit} {
-			return $pos
-		}
+	return [concat [list $path] $key [list $mailmap $ignore]]
+}
+
+method _cache_file {key} {
+	return [file join [gitdir gui-blame-cache] [blame_data::digest $key]]
+}
 
-		set pos $new_pos
+method _cache_load {cur_w cur_d options} {
+	if {$cache_key eq {}} {
+		return 0
 	}
+	set key [list $cache_key $options]
+	set f [_cache_file $this $key]
+	set regions [$cur_d load $f $key]
+	if {$regions eq {}} {
+		return 0
+	}
+	catch {file mtime $f [clock seconds]}
+	_render_regions $this $cur_w $cur_d $regions
+	return 1
+}
 
-	return $pos
+method _cache_store {cur_w cur_d} {
+	if {$cache_key eq {}
+		|| [lsearch -exact $blame_opts($cur_w) -L] != -1} {
+		return
+	}
+	set key [list $cache_key $blame_opts($cur_w)]
+	set f [_cache_file $this $key]
+	catch {
+		file mkdir [file dirname $f]
+		$cur_d save $f.tmp $key
+		file rename -force $f.tmp $f
+		_trim_cache [file dirname $f]
+	}
+}
+
+# Drops the least recently used results until the cache fits into
+# gui.blamecachesize megabytes.
+#
+proc _trim_cache {dir} {
+	set limit [expr {[get_config gui.blamecachesize] * 1048576}]
+	set files [list]
+	set size 0
+	foreach f [glob -nocomplain -types f -directory $dir *] {
+		if {[catch {file stat $f st}]} continue
+		lappend files [list $st(mtime) $st(size) $f]
+		incr size $st(size)
+	}
+	foreach e [lsort -integer -index 0 $files] {
+		if {$size <= $limit} break
+		foreach {mtime fsize f} $e break
+		if {![catch {file delete $f}]} {
+			incr size -$fsize
+		}
+	}
 }
 
 method _fullcopyblame {} {
-	if {$current_fd ne {}} {
+	if {$current_fd ne {} || [info exists blame_fd($w_amov)]} {
 		tk_messageBox \
 			-icon error \
 			-type ok \
@@ -856,10 +1250,10 @@ method _fullcopyblame {} {
 	# Find the line range
 	set pos @$::cursorX,$::cursorY
 	set lno [lindex [split [$::cursorW index $pos] .] 0]
-	set min_amov_lno [_find_commit_bound $this @amov_data $lno -1]
-	set max_amov_lno [_find_commit_bound $this @amov_data $lno 1]
-	set min_asim_lno [_find_commit_bound $this @asim_data $lno -1]
-	set max_asim_lno [_find_commit_bound $this @asim_data $lno 1]
+	set min_amov_lno [$amov_data bound $lno -1]
+	set max_amov_lno [$amov_data bound $lno 1]
+	set min_asim_lno [$asim_data bound $lno -1]
+	set max_asim_lno [$asim_data bound $lno 1]
 
 	if {$min_asim_lno < $min_amov_lno} {
 		set min_amov_lno $min_asim_lno
@@ -872,12 +1266,10 @@ method _fullcopyblame {} {
 	lappend original_options -L "$min_amov_lno,$max_amov_lno"
 
 	# Clear lines
-	for {set i $min_amov_lno} {$i <= $max_amov_lno} {incr i} {
-		lset amov_data $i [list ]
-	}
+	$amov_data clear $min_amov_lno $max_amov_lno
 
 	# Start the back-end process
-	_exec_blame $this $w_amov @amov_data \
+	_exec_blame $this $w_amov $amov_data \
 		$original_options \
 		[mc "Running thorough copy detection..."]
 }
@@ -898,9 +1290,8 @@ method _setencoding {enc} {
 }
 
 method _load_commit {cur_w cur_d pos} {
-	upvar #0 $cur_d line_data
 	set lno [lindex [split [$cur_w index $pos] .] 0]
-	set dat [lindex $line_data $lno]
+	set dat [$cur_d get $lno]
 	if {$dat ne {}} {
 		_load_new_commit $this  \
 			[lindex $dat 0] \
@@ -910,13 +1301,11 @@ method _load_commit {cur_w cur_d pos} {
 }
 
 method _load_new_commit {new_commit new_path jump} {
-	lappend history [list \
-		$commit $path \
-		$highlight_column \
-		$highlight_line \
-		[lindex [$w_file xview] 0] \
-		[lindex [$w_file yview] 0] \
-		]
+	lappend history [_location $this]
+	foreach e $future {
+		_drop_state $this [lindex $e 6]
+	}
+	set future {}
 
 	set commit $new_commit
 	set path   $new_path
@@ -935,10 +1324,10 @@ method _showcommit {cur_w lno} {
 	}
 
 	if {$cur_w eq $w_asim} {
-		set dat [lindex $asim_data $lno]
+		set dat [$asim_data get $lno]
 		set highlight_column $w_asim
 	} else {
-		set dat [lindex $amov_data $lno]
+		set dat [$amov_data get $lno]
 		set highlight_column $w_amov
 	}
 
@@ -961,43 +1350,15 @@ method _showcommit {cur_w lno} {
 			$i tag raise sel
 		}
 
-		set author_name {}
-		set author_email {}
-		set author_time {}
-		catch {set author_name $header($cmit,author)}
-		catch {set author_email $header($cmit,author-mail)}
-		catch {set author_time [format_date $header($cmit,author-time)]}
-
-		set committer_name {}
-		set committer_email {}
-		set committer_time {}
-		catch {set committer_name $header($cmit,committer)}
-		catch {set committer_email $header($cmit,committer-mail)}
-		catch {set committer_time [format_date $header($cmit,committer-time)]}
-
-		if {[catch {set msg $header($cmit,message)}]} {
-			set msg {}
-			catch {
-				set fd [git_read cat-file commit $cmit]
-				fconfigure $fd -encoding binary -translation lf
-				# By default commits are assumed to be in utf-8
-				set enc utf-8
-				while {[gets $fd line] > 0} {
-					if {[string match {encoding *} $line]} {
-						set enc [string tolower [string range $line 9 end]]
-					}
-				}
-				set msg [read $fd]
-				close $fd
+		set author_name [commit_store::get $cmit author]
+		set author_email [commit_store::get $cmit author-mail]
+		set author_time [format_date [commit_store::get $cmit author-time]]
 
-				set enc [tcl_encoding $enc]
-				if {$enc ne {}} {
-					set msg [encoding convertfrom $enc $msg]
-				}
-				set msg [string trim $msg]
-			}
-			set header($cmit,message) $msg
-		}
+		set committer_name [commit_store::get $cmit committer]
+		set committer_email [commit_store::get $cmit committer-mail]
+		set committer_time [format_date [commit_store::get $cmit committer-time]]
+
+		set msg [commit_store::get $cmit message]
 
 		$w_cviewer insert end "commit $cmit\n" header_key
 		$w_cviewer insert end [strcat [mc "Author:"] "\t"] header_key
@@ -1028,7 +1389,7 @@ method _showcommit {cur_w lno} {
 method _get_click_amov_info {} {
 	set pos @$::cursorX,$::cursorY
 	set lno [lindex [split [$::cursorW index $pos] .] 0]
-	return [lindex $amov_data $lno]
+	return [$amov_data get $lno]
 }
 
 method _copycommit {} {
@@ -1066,11 +1427,8 @@ method _gitkcommit {} {
 		set cmdline [list --select-commit=$cmit]
 
 		if {$radius > 0} {
-			set author_time {}
-			set committer_time {}
-
-			catch {set author_time $header($cmit,author-time)}
-			catch {set committer_time $header($cmit,committer-time)}
+			set author_time [commit_store::get $cmit author-time]
+			set committer_time [commit_store::get $cmit committer-time]
 
 			if {$committer_time eq {}} {
 				set committer_time $author_time
@@ -1228,11 +1586,11 @@ method _open_tooltip {cur_w} {
 		[expr {$pos_y - [winfo rooty $cur_w]}]] ,]
 	set lno [lindex [split [$cur_w index $pos] .] 0]
 	if {$cur_w eq $w_amov} {
-		set dat [lindex $amov_data $lno]
+		set dat [$amov_data get $lno]
 		set org {}
 	} else {
-		set dat [lindex $asim_data $lno]
-		set org [lindex $amov_data $lno]
+		set dat [$asim_data get $lno]
+		set org [$amov_data get $lno]
 	}
 
 	if {$dat eq {}} {
@@ -1243,12 +1601,9 @@ method _open_tooltip {cur_w} {
 	set cmit [lindex $dat 0]
 	set tooltip_commit [list $cmit]
 
-	set author_name {}
-	set summary     {}
-	set author_time {}
-	catch {set author_name $header($cmit,author)}
-	catch {set summary     $header($cmit,summary)}
-	catch {set author_time [format_date $header($cmit,author-time)]}
+	set author_name [commit_store::get $cmit author]
+	set summary     [commit_store::get $cmit summary]
+	set author_time [format_date [commit_store::get $cmit author-time]]
 
 	$tooltip_t insert end "commit $cmit\n"
 	$tooltip_t insert end "$author_name  $author_time\n"
@@ -1262,12 +1617,9 @@ method _open_tooltip {cur_w} {
 		set file [lindex $org 1]
 		lappend tooltip_commit $cmit
 
-		set author_name {}
-		set summary     {}
-		set author_time {}
-		catch {set author_name $header($cmit,author)}
-		catch {set summary     $header($cmit,summary)}
-		catch {set author_time [format_date $header($cmit,author-time)]}
+		set author_name [commit_store::get $cmit author]
+		set summary     [commit_store::get $cmit summary]
+		set author_time [format_date [commit_store::get $cmit author-time]]
 
 		$tooltip_t insert end [strcat [mc "Originally By:"] "\n"] section_header
 		$tooltip_t insert end "commit $cmit\n"
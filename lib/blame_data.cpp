@@ -0,0 +1,758 @@
+// git-guing: annotation data of the blame viewer
+//
+// git blame --incremental output is parsed here, and the result is kept
+// in compact per-line arrays: an index into a table of commits, an index
+// into a table of file names, and the line number in the original file.
+// Line numbers on the Tcl side start at 1, as in git blame and in the
+// text widgets; entry 0 is always empty.
+
+#include "blame_data.h"
+#include "commit_store.h"
+#include "native.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Commits and file names are shared by all viewers and interned, so that
+// each line only needs to refer to them by index. What is known about the
+// commits themselves is kept in the commit store.
+std::vector<std::string> commits;
+std::unordered_map<std::string, int32_t> commit_index;
+std::vector<std::string> files;
+std::unordered_map<std::string, int32_t> file_index;
+
+int32_t intern_commit(const std::string& id)
+{
+	auto it = commit_index.find(id);
+	if (it != commit_index.end())
+		return it->second;
+	commits.push_back(id);
+	return commit_index[id] = commits.size() - 1;
+}
+
+int32_t intern_file(const std::string& name)
+{
+	auto it = file_index.find(name);
+	if (it != file_index.end())
+		return it->second;
+	files.push_back(name);
+	return file_index[name] = files.size() - 1;
+}
+
+struct Line
+{
+	int32_t commit = -1;	// -1 if not annotated (yet)
+	int32_t file = -1;
+	int32_t orig_line = 0;
+	int color = 0;		// group color of the run of lines
+
+	bool same_origin(const Line& o) const
+	{
+		return commit == o.commit && file == o.file;
+	}
+};
+
+struct Annotation
+{
+	std::vector<Line> lines{1};
+
+	// the region whose header was seen last
+	int32_t r_commit = -1;
+	int r_orig_line = 0;
+	int r_final_line = 0;
+	int r_line_count = 0;
+
+	const Line& at(int lno) const
+	{
+		static const Line none;
+		return lno > 0 && lno < int(lines.size()) ? lines[lno] : none;
+	}
+	Tcl_Obj* region(int lno, int n, int32_t file);
+	int bound(int pos, int delta) const;
+};
+
+// Parses "<sha1> <orig line> <final line> <count>".
+bool parse_region_header(const std::string& line, std::string& id, int num[3])
+{
+	auto sp = line.find(' ');
+	if (sp == std::string::npos)
+		return false;
+	id = line.substr(0, sp);
+	if (!is_hex_id(id))
+		return false;
+	const char* p = line.c_str() + sp;
+	for (int i = 0; i < 3; i++)
+	{
+		if (*p != ' ' || !std::isdigit(static_cast<unsigned char>(p[1])))
+			return false;
+		char* end;
+		num[i] = std::strtol(p + 1, &end, 10);
+		p = end;
+	}
+	return *p == '\0';
+}
+
+// Assigns the region whose filename line was just seen and describes it
+// for the renderer as {lno count first end commit file olds}: first is the
+// first line of the run of lines from the same commit and file that the
+// region extends, end is the line after that run, and olds are the
+// commits that the region's lines were attributed to before. The run is
+// given a group color, 0, 1 or 2, that differs from those of the runs
+// before and after it.
+Tcl_Obj* Annotation::region(int lno, int n, int32_t file)
+{
+	if (int(lines.size()) < lno + n)
+		lines.resize(lno + n);
+
+	Line l;
+	l.commit = r_commit;
+	l.file = file;
+
+	int first = lno;
+	while (first > 1 && lines[first - 1].same_origin(l))
+		first--;
+
+	auto olds = Tcl_NewListObj(0, nullptr);
+	std::vector<int32_t> seen;
+	for (int i = 0; i < n; i++)
+	{
+		auto& cur = lines[lno + i];
+		if (cur.commit >= 0 && cur.commit != l.commit) {
+			bool known = false;
+			for (auto c : seen)
+				known = known || c == cur.commit;
+			if (!known) {
+				seen.push_back(cur.commit);
+				Tcl_ListObjAppendElement(nullptr, olds,
+					tcl_obj(commits[cur.commit]));
+			}
+		}
+		cur = l;
+		cur.orig_line = r_orig_line + i;
+	}
+
+	int end = lno + n;
+	while (end < int(lines.size()) && lines[end].same_origin(l))
+		end++;
+
+	int color = 0;
+	if (first < lno) {
+		color = lines[first].color;
+	} else {
+		auto used = [&](int c) {
+			return (first > 1 && lines[first - 1].commit >= 0
+					&& lines[first - 1].color == c)
+				|| (end < int(lines.size()) && lines[end].commit >= 0
+					&& lines[end].color == c);
+		};
+		while (used(color))
+			color++;
+	}
+	for (int i = lno; i < end; i++)
+		lines[i].color = color;
+
+	Tcl_Obj* r[7] = {
+		Tcl_NewIntObj(lno),
+		Tcl_NewIntObj(n),
+		Tcl_NewIntObj(first),
+		Tcl_NewIntObj(end),
+		tcl_obj(commits[l.commit]),
+		tcl_obj(files[file]),
+		olds,
+	};
+	return Tcl_NewListObj(7, r);
+}
+
+// The last line from pos on, going in steps of delta, that is attributed
+// to the same commit as pos.
+int Annotation::bound(int pos, int delta) const
+{
+	int limit = int(lines.size()) - 1;
+	int32_t base = at(pos).commit;
+	while (pos > 0 && pos < limit) {
+		int next = pos + delta;
+		if (at(next).commit != base)
+			return pos;
+		pos = next;
+	}
+	return pos;
+}
+
+Tcl_Obj* line_obj(const Line& l)
+{
+	auto r = Tcl_NewListObj(0, nullptr);
+	if (l.commit >= 0) {
+		Tcl_ListObjAppendElement(nullptr, r, tcl_obj(commits[l.commit]));
+		Tcl_ListObjAppendElement(nullptr, r, tcl_obj(files[l.file]));
+		Tcl_ListObjAppendElement(nullptr, r, Tcl_NewIntObj(l.orig_line));
+	}
+	return r;
+}
+
+// $data parse lines
+// Feeds lines of git blame --incremental output to the parser and returns
+// the list of the regions that were completed by them.
+int parse(Annotation& a, Tcl_Interp* interp, Tcl_Obj* list)
+{
+	Tcl_Obj** lines;
+	int n;
+	if (Tcl_ListObjGetElements(interp, list, &n, &lines) != TCL_OK)
+		return TCL_ERROR;
+
+	auto result = Tcl_NewListObj(0, nullptr);
+	std::string id;
+	int num[3];
+	for (int i = 0; i < n; i++)
+	{
+		auto line = tcl_string(lines[i]);
+		if (parse_region_header(line, id, num)) {
+			a.r_commit = intern_commit(id);
+			a.r_orig_line = num[0];
+			a.r_final_line = num[1];
+			a.r_line_count = num[2];
+		} else if (line.compare(0, 9, "filename ") == 0) {
+			if (a.r_commit < 0 || a.r_final_line < 1)
+				continue;
+			Tcl_ListObjAppendElement(nullptr, result,
+				a.region(a.r_final_line, a.r_line_count,
+					intern_file(line.substr(9))));
+		} else if (a.r_commit >= 0) {
+			// "key value" header lines of the current commit
+			auto sp = line.find(' ');
+			if (sp == std::string::npos || sp == 0)
+				continue;
+			bool key = true;
+			for (size_t k = 0; k < sp; k++)
+				key = key && ((line[k] >= 'a' && line[k] <= 'z') || line[k] == '-');
+			if (key && line.compare(0, sp, "previous") != 0)
+				commit_learn(commits[a.r_commit], line.substr(0, sp), line.substr(sp + 1));
+		}
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// The cache file format: the magic, the key, the number of lines, the
+// commits with their headers, the file names, and then the regions as
+// {first line, count, commit, file, original line, color}. Numbers are
+// 32 bit little endian, strings are prefixed with their length.
+const char cache_magic[] = "git-gui blame cache 1\n";
+
+void put_u32(std::string& out, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		out += char((v >> (8 * i)) & 0xff);
+}
+
+void put_str(std::string& out, const std::string& s)
+{
+	put_u32(out, s.size());
+	out += s;
+}
+
+struct Reader
+{
+	const std::string& buf;
+	size_t pos = 0;
+	bool ok = true;
+
+	explicit Reader(const std::string& b) : buf(b) {}
+
+	uint32_t u32()
+	{
+		if (buf.size() - pos < 4) {
+			ok = false;
+			return 0;
+		}
+		uint32_t v = 0;
+		for (int i = 0; i < 4; i++)
+			v |= uint32_t(static_cast<unsigned char>(buf[pos + i])) << (8 * i);
+		pos += 4;
+		return v;
+	}
+	std::string str()
+	{
+		uint32_t n = u32();
+		if (!ok || buf.size() - pos < n) {
+			ok = false;
+			return {};
+		}
+		pos += n;
+		return buf.substr(pos - n, n);
+	}
+	// Reads the count of records of at least size bytes each, which
+	// must fit into what is left.
+	uint32_t count(size_t size)
+	{
+		uint32_t n = u32();
+		if (!ok || n > (buf.size() - pos) / size) {
+			ok = false;
+			return 0;
+		}
+		return n;
+	}
+};
+
+// $data save path key
+// Writes the annotations to the cache file path, tagged with key.
+int save(Annotation& a, Tcl_Interp* interp, Tcl_Obj* path, Tcl_Obj* key)
+{
+	std::unordered_map<int32_t, uint32_t> cmap, fmap;
+	std::vector<int32_t> clist, flist;
+	std::string regions;
+	uint32_t nregions = 0;
+
+	int n = a.lines.size();
+	for (int i = 1; i < n; )
+	{
+		auto& l = a.lines[i];
+		int s = i++;
+		while (i < n && a.lines[i].same_origin(l)
+			&& a.lines[i].color == l.color
+			&& a.lines[i].orig_line == l.orig_line + (i - s))
+			i++;
+		if (l.commit < 0)
+			continue;
+		if (!cmap.count(l.commit)) {
+			cmap[l.commit] = clist.size();
+			clist.push_back(l.commit);
+		}
+		if (!fmap.count(l.file)) {
+			fmap[l.file] = flist.size();
+			flist.push_back(l.file);
+		}
+		put_u32(regions, s);
+		put_u32(regions, i - s);
+		put_u32(regions, cmap[l.commit]);
+		put_u32(regions, fmap[l.file]);
+		put_u32(regions, l.orig_line);
+		put_u32(regions, l.color);
+		nregions++;
+	}
+
+	std::string out = cache_magic;
+	put_str(out, tcl_string(key));
+	put_u32(out, n - 1);
+	put_u32(out, clist.size());
+	for (auto c : clist)
+	{
+		auto fields = commit_fields(commits[c]);
+		put_str(out, commits[c]);
+		put_u32(out, fields.size());
+		for (auto& h : fields)
+		{
+			put_str(out, h.first);
+			put_str(out, h.second);
+		}
+	}
+	put_u32(out, flist.size());
+	for (auto f : flist)
+		put_str(out, files[f]);
+	put_u32(out, nregions);
+	out += regions;
+
+	auto chan = Tcl_FSOpenFileChannel(interp, path, "w", 0644);
+	if (!chan)
+		return TCL_ERROR;
+	Tcl_SetChannelOption(interp, chan, "-translation", "binary");
+	bool ok = Tcl_Write(chan, out.data(), out.size()) == int(out.size());
+	if (Tcl_Close(interp, chan) != TCL_OK)
+		return TCL_ERROR;
+	if (!ok) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write %s: %s",
+			Tcl_GetString(path), Tcl_ErrnoMsg(Tcl_GetErrno())));
+		return TCL_ERROR;
+	}
+	return TCL_OK;
+}
+
+// $data load path key
+// Replaces the annotations with those of the cache file path, and
+// returns the regions like parse does. Returns an empty list without
+// touching the annotations if the file is unreadable, damaged, was
+// written for a different key, or for a different number of lines than
+// the annotations were resized to.
+int load(Annotation& a, Tcl_Interp* interp, Tcl_Obj* path, Tcl_Obj* key)
+{
+	auto chan = Tcl_FSOpenFileChannel(nullptr, path, "r", 0);
+	if (!chan)
+		return TCL_OK;
+	Tcl_SetChannelOption(nullptr, chan, "-translation", "binary");
+	std::string buf;
+	char chunk[65536];
+	int got;
+	while ((got = Tcl_Read(chan, chunk, sizeof(chunk))) > 0)
+		buf.append(chunk, got);
+	Tcl_Close(nullptr, chan);
+
+	size_t mlen = sizeof(cache_magic) - 1;
+	if (buf.compare(0, mlen, cache_magic) != 0)
+		return TCL_OK;
+	Reader r(buf);
+	r.pos = mlen;
+	if (r.str() != tcl_string(key) || !r.ok)
+		return TCL_OK;
+	// The file was resized to its lines before, which also keeps a
+	// damaged count from making us allocate without bounds.
+	uint32_t nlines = r.u32();
+	if (nlines == UINT32_MAX || nlines + size_t(1) != a.lines.size())
+		return TCL_OK;
+
+	std::vector<std::pair<std::string, std::map<std::string, std::string>>> cs(r.count(8));
+	for (auto& c : cs)
+	{
+		if (!r.ok)
+			return TCL_OK;
+		c.first = r.str();
+		uint32_t nh = r.count(8);
+		for (uint32_t k = 0; k < nh && r.ok; k++)
+		{
+			auto name = r.str();
+			c.second[name] = r.str();
+		}
+	}
+	std::vector<std::string> fs(r.ok ? r.count(4) : 0);
+	for (auto& f : fs)
+		f = r.str();
+	struct Region { uint32_t lno, n, c, f, oln, color; };
+	std::vector<Region> rs(r.ok ? r.count(sizeof(Region)) : 0);
+	for (auto& x : rs)
+	{
+		x.lno = r.u32();
+		x.n = r.u32();
+		x.c = r.u32();
+		x.f = r.u32();
+		x.oln = r.u32();
+		x.color = r.u32();
+		if (x.c >= cs.size() || x.f >= fs.size() || x.color > 2 || x.lno < 1
+			|| x.n > nlines || x.lno > nlines - x.n + 1)
+			r.ok = false;
+	}
+	if (!r.ok || r.pos != buf.size())
+		return TCL_OK;
+
+	std::vector<int32_t> cidx, fidx;
+	for (auto& c : cs)
+	{
+		cidx.push_back(intern_commit(c.first));
+		for (auto& h : c.second)
+			commit_learn(c.first, h.first, h.second);
+	}
+	for (auto& f : fs)
+		fidx.push_back(intern_file(f));
+
+	a.lines.assign(size_t(nlines) + 1, Line());
+	auto result = Tcl_NewListObj(0, nullptr);
+	for (auto& x : rs)
+	{
+		a.r_commit = cidx[x.c];
+		a.r_orig_line = x.oln;
+		Tcl_ListObjAppendElement(nullptr, result, a.region(x.lno, x.n, fidx[x.f]));
+	}
+	a.r_commit = -1;
+
+	// Keep the colors that were shown when the file was annotated.
+	for (auto& x : rs)
+		for (uint32_t i = 0; i < x.n; i++)
+			a.lines[x.lno + i].color = x.color;
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+int cmd_data(ClientData cd, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[]);
+
+void delete_data(ClientData cd)
+{
+	delete static_cast<Annotation*>(cd);
+}
+
+// $data assign from
+// Replaces the annotations with a copy of those of the blame_data command
+// from, and returns the regions like parse does, one for each run of
+// consecutive lines of the same origin.
+int assign(Annotation& a, Tcl_Interp* interp, Tcl_Obj* from)
+{
+	Tcl_CmdInfo info;
+	if (!Tcl_GetCommandInfo(interp, Tcl_GetString(from), &info)
+			|| info.objProc != cmd_data) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is not blame data",
+			Tcl_GetString(from)));
+		return TCL_ERROR;
+	}
+	auto src = static_cast<Annotation*>(info.objClientData)->lines;
+
+	a.lines.assign(src.size(), Line());
+	auto result = Tcl_NewListObj(0, nullptr);
+	for (int i = 1; i < int(src.size()); )
+	{
+		auto& l = src[i];
+		int n = 1;
+		while (i + n < int(src.size()) && src[i + n].same_origin(l)
+				&& src[i + n].orig_line == l.orig_line + n
+				&& src[i + n].color == l.color)
+			n++;
+		if (l.commit >= 0) {
+			a.r_commit = l.commit;
+			a.r_orig_line = l.orig_line;
+			Tcl_ListObjAppendElement(nullptr, result, a.region(i, n, l.file));
+		}
+		i += n;
+	}
+	a.r_commit = -1;
+
+	for (int i = 1; i < int(src.size()); i++)
+		a.lines[i].color = src[i].color;
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// $data resize count
+//	The file has count lines; annotations beyond are dropped.
+// $data get lno
+//	Returns {commit file origline} of the line, or {} if the line is not
+//	annotated.
+// $data commit lno
+//	Returns the commit of the line, or {}.
+// $data color lno
+//	Returns the group color of the line.
+// $data runs first end
+//	Returns {start end commit color ...} for the runs of annotated lines
+//	of the same commit from first up to but excluding end.
+// $data clear first last
+//	Forgets the annotations of lines first to last.
+// $data missing first last
+//	Returns the ranges {from to} of lines first to last that are not
+//	annotated.
+// $data bound lno delta
+//	See Annotation::bound().
+// $data parse lines
+//	See parse().
+// $data save path key
+//	See save().
+// $data load path key
+//	See load().
+// $data copy name
+//	Creates the command name for a copy of the annotations.
+// $data assign from
+//	See assign().
+int cmd_data(ClientData cd, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	static const char* const subcmds[] = {
+		"resize", "get", "commit", "color", "runs", "clear", "missing",
+		"bound", "parse", "save", "load", "copy", "assign", nullptr
+	};
+	enum { RESIZE, GET, COMMIT, COLOR, RUNS, CLEAR, MISSING, BOUND, PARSE,
+		SAVE, LOAD, COPY, ASSIGN };
+	static const int nargs[] = { 3, 3, 3, 3, 4, 4, 4, 4, 3, 4, 4, 3, 3 };
+	static const char* const usage[] = {
+		"resize count", "get lno", "commit lno", "color lno",
+		"runs first end", "clear first last", "missing first last",
+		"bound lno delta", "parse lines", "save path key", "load path key",
+		"copy name", "assign from",
+	};
+
+	auto& a = *static_cast<Annotation*>(cd);
+	int idx;
+	if (objc < 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?arg ...?");
+		return TCL_ERROR;
+	}
+	if (Tcl_GetIndexFromObj(interp, objv[1], subcmds, "subcommand", 0, &idx) != TCL_OK)
+		return TCL_ERROR;
+	if (objc != nargs[idx]) {
+		Tcl_WrongNumArgs(interp, 1, objv, usage[idx]);
+		return TCL_ERROR;
+	}
+	if (idx == PARSE)
+		return parse(a, interp, objv[2]);
+	if (idx == SAVE)
+		return save(a, interp, objv[2], objv[3]);
+	if (idx == LOAD)
+		return load(a, interp, objv[2], objv[3]);
+	if (idx == COPY) {
+		Tcl_CreateObjCommand(interp, Tcl_GetString(objv[2]), cmd_data,
+			new Annotation(a), delete_data);
+		Tcl_SetObjResult(interp, objv[2]);
+		return TCL_OK;
+	}
+	if (idx == ASSIGN)
+		return assign(a, interp, objv[2]);
+
+	int x, y = 0;
+	if (!tcl_int(interp, objv[2], x) || (objc > 3 && !tcl_int(interp, objv[3], y)))
+		return TCL_ERROR;
+
+	switch (idx) {
+	case RESIZE:
+		a.lines.resize(std::max(x, 0) + 1);
+		break;
+	case GET:
+		Tcl_SetObjResult(interp, line_obj(a.at(x)));
+		break;
+	case COMMIT:
+		if (a.at(x).commit >= 0)
+			Tcl_SetObjResult(interp, tcl_obj(commits[a.at(x).commit]));
+		break;
+	case COLOR:
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(a.at(x).color));
+		break;
+	case RUNS: {
+		auto r = Tcl_NewListObj(0, nullptr);
+		int i = std::max(x, 1);
+		y = std::min(y, int(a.lines.size()));
+		while (i < y) {
+			int s = i;
+			auto& l = a.lines[i];
+			while (i < y && a.lines[i].commit == l.commit
+					&& a.lines[i].color == l.color)
+				i++;
+			if (l.commit < 0)
+				continue;
+			Tcl_ListObjAppendElement(nullptr, r, Tcl_NewIntObj(s));
+			Tcl_ListObjAppendElement(nullptr, r, Tcl_NewIntObj(i));
+			Tcl_ListObjAppendElement(nullptr, r, tcl_obj(commits[l.commit]));
+			Tcl_ListObjAppendElement(nullptr, r, Tcl_NewIntObj(l.color));
+		}
+		Tcl_SetObjResult(interp, r);
+		break;
+	}
+	case CLEAR:
+		for (int i = std::max(x, 1); i <= y && i < int(a.lines.size()); i++)
+			a.lines[i] = Line();
+		break;
+	case MISSING: {
+		auto r = Tcl_NewListObj(0, nullptr);
+		int i = std::max(x, 1);
+		y = std::min(y, int(a.lines.size()) - 1);
+		while (i <= y) {
+			if (a.lines[i].commit >= 0) {
+				i++;
+				continue;
+			}
+			int s = i;
+			while (i <= y && a.lines[i].commit < 0)
+				i++;
+			Tcl_Obj* range[] = { Tcl_NewIntObj(s), Tcl_NewIntObj(i - 1) };
+			Tcl_ListObjAppendElement(nullptr, r, Tcl_NewListObj(2, range));
+		}
+		Tcl_SetObjResult(interp, r);
+		break;
+	}
+	case BOUND:
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(a.bound(x, y)));
+		break;
+	}
+	return TCL_OK;
+}
+
+// blame_data::new name
+// Creates the command name for a new, empty set of annotations. The data
+// goes away when the command is deleted.
+int cmd_new(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "name");
+		return TCL_ERROR;
+	}
+	Tcl_CreateObjCommand(interp, Tcl_GetString(objv[1]), cmd_data,
+		new Annotation, delete_data);
+	Tcl_SetObjResult(interp, objv[1]);
+	return TCL_OK;
+}
+
+// FNV-1a, continuing from the hash h of what came before.
+uint64_t fnv1a(const char* p, size_t len, uint64_t h = 0xcbf29ce484222325ull)
+{
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ static_cast<unsigned char>(p[i])) * 0x100000001b3ull;
+	return h;
+}
+
+Tcl_Obj* digest_obj(uint64_t h)
+{
+	char buf[17];
+	snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+	return Tcl_NewStringObj(buf, -1);
+}
+
+// blame_data::digest string
+// Returns a short hash of the string, suitable as a cache file name.
+int cmd_digest(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "string");
+		return TCL_ERROR;
+	}
+	int len;
+	const char* p = Tcl_GetStringFromObj(objv[1], &len);
+	Tcl_SetObjResult(interp, digest_obj(fnv1a(p, len)));
+	return TCL_OK;
+}
+
+// blame_data::file_digest path
+// Returns a short hash of the bytes of the file, or an empty string if it
+// cannot be read.
+int cmd_file_digest(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "path");
+		return TCL_ERROR;
+	}
+	auto chan = Tcl_FSOpenFileChannel(nullptr, objv[1], "r", 0);
+	if (!chan)
+		return TCL_OK;
+	Tcl_SetChannelOption(nullptr, chan, "-translation", "binary");
+
+	uint64_t h = fnv1a(nullptr, 0);
+	char chunk[65536];
+	int got;
+	while ((got = Tcl_Read(chan, chunk, sizeof(chunk))) > 0)
+		h = fnv1a(chunk, got, h);
+	Tcl_Close(nullptr, chan);
+	if (got == 0)
+		Tcl_SetObjResult(interp, digest_obj(h));
+	return TCL_OK;
+}
+
+// blame_data::numbers first count
+// Returns the text of the line number column for count lines starting at
+// line first: the numbers separated by line feeds.
+int cmd_numbers(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int first, count;
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "first count");
+		return TCL_ERROR;
+	}
+	if (!tcl_int(interp, objv[1], first) || !tcl_int(interp, objv[2], count))
+		return TCL_ERROR;
+
+	std::string out;
+	out.reserve(size_t(std::max(count, 0)) * 8);
+	char buf[16];
+	for (int i = 0; i < count; i++)
+	{
+		int len = snprintf(buf, sizeof(buf), i ? "\n%d" : "%d", first + i);
+		out.append(buf, len);
+	}
+	Tcl_SetObjResult(interp, tcl_obj(out));
+	return TCL_OK;
+}
+
+} // namespace
+
+void blame_data_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "blame_data::new", cmd_new, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "blame_data::digest", cmd_digest, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "blame_data::file_digest", cmd_file_digest, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "blame_data::numbers", cmd_numbers, nullptr, nullptr);
+}
@@ -0,0 +1,7 @@
+// git-guing: annotation data of the blame viewer
+
+#pragma once
+
+#include <tcl.h>
+
+void blame_data_init(Tcl_Interp* interp);
@@ -15,13 +15,31 @@ image create photo ::browser::img_unknown -data {R0lGODlhEAAQAIUAAPwCBFxaXIyKjNT
 
 field w
 field browser_commit
+field commit_id    {}; # of browser_commit, or {} if it is no commit
 field browser_path
-field browser_files  {}
 field browser_status [mc "Starting..."]
 field browser_stack  {}
 field browser_busy   1
 
-field ls_buf     {}; # Buffered record output from ls-tree
+field prefetch_id {}; # timer for reading the subdirectories ahead
+
+# The list only holds the rows that fit into the window. They are taken
+# from the tree store, or from the matches of "go to file", and are put
+# in again whenever the list scrolls.
+#
+field w_sby        ; # vertical scrollbar of the list
+field list_tree  {}; # tree listed, or {} to list found_rows
+field found_rows {}; # matches of "go to file": {found type path}
+field list_parent 0; # whether row 0 leads to the parent directory
+field list_count  0; # rows in the list
+field list_top    0; # first row shown
+field list_sel    0; # row selected
+
+field w_goto       ; # "go to file" entry
+field goto_text  {}; # what is typed into $w_goto
+field goto_fd    {}; # git ls-tree -r filling the path index
+field goto_poll  {}; # timer to look again while another reads it
+variable goto_limit 500; # most matches shown
 
 constructor new {commit {path {}}} {
 	global cursor_ptr M1B use_ttk NS
@@ -36,6 +54,7 @@ constructor new {commit {path {}}} {
 	}
 
 	set browser_commit $commit
+	set commit_id [lindex [commit_store::fetch [list $commit]] 0]
 	set browser_path "$browser_commit:[escape_path $path]"
 
 	${NS}::label $w.path \
@@ -46,6 +65,17 @@ constructor new {commit {path {}}} {
 	if {!$use_ttk} { $w.path configure -borderwidth 1 -relief sunken}
 	pack $w.path -anchor w -side top -fill x
 
+	${NS}::frame $w.goto
+	${NS}::label $w.goto.l -text [mc "Go to file:"]
+	set w_goto $w.goto.e
+	${NS}::entry $w_goto \
+		-textvariable @goto_text \
+		-validate key \
+		-validatecommand [cb _goto_filter %P]
+	pack $w.goto.l -side left
+	pack $w_goto -side left -fill x -expand 1
+	pack $w.goto -side top -fill x -pady 2
+
 	${NS}::frame $w.list
 	set w_list $w.list.l
 	text $w_list -background white -foreground black \
@@ -55,13 +85,13 @@ constructor new {commit {path {}}} {
 		-wrap none \
 		-height 20 \
 		-width 70 \
-		-xscrollcommand [list $w.list.sbx set] \
-		-yscrollcommand [list $w.list.sby set]
+		-xscrollcommand [list $w.list.sbx set]
 	rmsel_tag $w_list
+	set w_sby $w.list.sby
 	${NS}::scrollbar $w.list.sbx -orient h -command [list $w_list xview]
-	${NS}::scrollbar $w.list.sby -orient v -command [list $w_list yview]
+	${NS}::scrollbar $w_sby -orient v -command [cb _yview]
 	pack $w.list.sbx -side bottom -fill x
-	pack $w.list.sby -side right -fill y
+	pack $w_sby -side right -fill y
 	pack $w_list -side left -fill both -expand 1
 	pack $w.list -side top -fill both -expand 1
 
@@ -84,8 +114,16 @@ constructor new {commit {path {}}} {
 	bind $w_list <Next>            "[cb _page  1]       ;break"
 	bind $w_list <Left>            break
 	bind $w_list <Right>           break
+	bind $w_list <MouseWheel>      "[cb _wheel %D]      ;break"
+	bind $w_list <Button-4>        "[cb _yview scroll -3 units];break"
+	bind $w_list <Button-5>        "[cb _yview scroll  3 units];break"
+	bind $w_list <Configure>       [cb _render]
 
 	bind $w_list <Visibility> [list focus $w_list]
+	bind $w_goto <FocusIn>    [cb _index]
+	bind $w_goto <Key-Return> "[cb _enter];break"
+	bind $w_goto <Key-Down>   [list focus $w_list]
+	bind $w_goto <Key-Escape> "[cb _goto_clear];break"
 	wm deiconify $top
 	set w $w_list
 	if {$path ne {}} {
@@ -98,33 +136,54 @@ constructor new {commit {path {}}} {
 
 method _move {dir} {
 	if {$browser_busy} return
-	set lno [lindex [split [$w index in_sel.first] .] 0]
-	incr lno $dir
-	if {[lindex $browser_files [expr {$lno - 1}]] ne {}} {
-		$w tag remove in_sel 0.0 end
-		$w tag add in_sel $lno.0 [expr {$lno + 1}].0
-		$w see $lno.0
+	set i [expr {$list_sel + $dir}]
+	if {$i >= 0 && $i < $list_count} {
+		set list_sel $i
+		set page [_page_rows $this]
+		if {$i < $list_top} {
+			set list_top $i
+		} elseif {$i >= $list_top + $page} {
+			set list_top [expr {$i - $page + 1}]
+		}
+		_render $this
 	}
 }
 
 method _page {dir} {
 	if {$browser_busy} return
-	$w yview scroll $dir pages
-	set lno [expr {int(
-		  [lindex [$w yview] 0]
-		* [llength $browser_files]
-		+ 1)}]
-	if {[lindex $browser_files [expr {$lno - 1}]] ne {}} {
-		$w tag remove in_sel 0.0 end
-		$w tag add in_sel $lno.0 [expr {$lno + 1}].0
-		$w see $lno.0
+	incr list_top [expr {$dir * [_page_rows $this]}]
+	_clamp_top $this
+	set list_sel $list_top
+	_render $this
+}
+
+method _yview {cmd args} {
+	switch -- $cmd {
+	moveto {
+		set list_top [expr {int([lindex $args 0] * $list_count)}]
+	}
+	scroll {
+		set n [lindex $args 0]
+		if {[lindex $args 1] eq {pages}} {
+			set n [expr {$n * [_page_rows $this]}]
+		}
+		incr list_top $n
+	}
+	}
+	_render $this
+}
+
+method _wheel {delta} {
+	if {$delta > 0} {
+		_yview $this scroll -3 units
+	} elseif {$delta < 0} {
+		_yview $this scroll 3 units
 	}
 }
 
 method _parent {} {
 	if {$browser_busy} return
-	set info [lindex $browser_files 0]
-	if {[lindex $info 0] eq {parent}} {
+	if {$list_parent} {
 		set parent [lindex $browser_stack end-1]
 		set browser_stack [lrange $browser_stack 0 end-2]
 		if {$browser_stack eq {}} {
@@ -139,8 +198,7 @@ method _parent {} {
 
 method _enter {} {
 	if {$browser_busy} return
-	set lno [lindex [split [$w index in_sel.first] .] 0]
-	set info [lindex $browser_files [expr {$lno - 1}]]
+	set info [_row $this $list_sel]
 	if {$info ne {}} {
 		switch -- [lindex $info 0] {
 		parent {
@@ -162,6 +220,16 @@ method _enter {} {
 			append p $name
 			blame::new $browser_commit $p {}
 		}
+		found {
+			set p [lindex $info 2]
+			switch -- [lindex $info 1] {
+			tree {_goto_dir $this $p}
+			blob {
+				set p [lindex $browser_stack 0 1]$p
+				blame::new $browser_commit $p {}
+			}
+			}
+		}
 		}
 	}
 }
@@ -169,11 +237,12 @@ method _enter {} {
 method _click {was_double_click pos} {
 	if {$browser_busy} return
 	set lno [lindex [split [$w index $pos] .] 0]
+	set i [expr {$list_top + $lno - 1}]
 	focus $w
 
-	if {[lindex $browser_files [expr {$lno - 1}]] ne {}} {
-		$w tag remove in_sel 0.0 end
-		$w tag add in_sel $lno.0 [expr {$lno + 1}].0
+	if {$i < $list_count} {
+		set list_sel $i
+		_render $this
 		if {$was_double_click} {
 			_enter $this
 		}
@@ -181,59 +250,158 @@ method _click {was_double_click pos} {
 }
 
 method _ls {tree_id {name {}}} {
-	set ls_buf {}
-	set browser_files {}
+	after cancel $prefetch_id
 	set browser_busy 1
 
-	$w conf -state normal
-	$w tag remove in_sel 0.0 end
-	$w delete 0.0 end
-	if {$browser_stack ne {}} {
-		$w image create end \
-			-align center -padx 5 -pady 1 \
-			-name icon0 \
-			-image ::browser::img_parent
-		$w insert end [mc "\[Up To Parent\]"]
-		lappend browser_files parent
+	# Trees are read through the tree store, which keeps the listings
+	# of the trees that were visited or prefetched before.
+	#
+	set tree [tree_store::fetch $tree_id]
+	if {$tree eq {}} {
+		set list_parent 0
+		_show $this {} {}
+		set browser_status [mc "Not a tree: %s" $tree_id]
+		set browser_busy 0
+		return
 	}
-	lappend browser_stack [list $tree_id $name]
-	$w conf -state disabled
+	set list_parent [expr {$browser_stack ne {}}]
+	lappend browser_stack [list $tree $name]
+	_show $this $tree {}
+
+	set browser_status [mc "Ready."]
+	if {$commit_id ne {}} {
+		array set cinfo [commit_store::get $commit_id]
+		if {[info exists cinfo(summary)] && $cinfo(summary) ne {}} {
+			set browser_status [format "%s (%s, %s)" $cinfo(summary) \
+				$cinfo(author) \
+				[format_date $cinfo(author-time)]]
+		}
+	}
+	set browser_busy 0
+	if {$list_count > 0} {
+		focus -force $w
+	}
+	set prefetch_id [after 100 [cb _prefetch $tree]]
+}
 
-	set fd [git_read ls-tree -z $tree_id]
-	fconfigure $fd -blocking 0 -translation binary -encoding utf-8
-	fileevent $fd readable [cb _read $fd]
+# Lists the tree, or the found rows if tree is empty, from the top.
+#
+method _show {tree rows} {
+	set list_tree $tree
+	set found_rows $rows
+	if {$tree ne {}} {
+		set list_count [tree_store::size $tree]
+	} else {
+		set list_count [llength $rows]
+	}
+	incr list_count $list_parent
+	set list_top 0
+	set list_sel 0
+	$w xview moveto 0
+	_render $this
 }
 
-method _read {fd} {
-	append ls_buf [read $fd]
-	set pck [split $ls_buf "\0"]
-	set ls_buf [lindex $pck end]
+# The rows first up to but excluding last as {type object name mode}, or
+# parent for the row leading to the parent directory.
+#
+method _rows {first last} {
+	set rows [list]
+	if {$list_parent} {
+		if {$first == 0 && $last > 0} {
+			lappend rows parent
+			incr first
+		}
+		incr first -1
+		incr last -1
+	}
+	if {$list_tree eq {}} {
+		return [concat $rows [lrange $found_rows $first [expr {$last - 1}]]]
+	}
+	set n [expr {$last - $first}]
+	foreach {mode type object name} [tree_store::list $list_tree $first $n] {
+		if {$type eq {tree}} {
+			append name /
+		}
+		lappend rows [list $type $object $name $mode]
+	}
+	return $rows
+}
 
-	set n [llength $browser_files]
-	$w conf -state normal
-	foreach p [lrange $pck 0 end-1] {
-		set tab [string first "\t" $p]
-		if {$tab == -1} continue
+method _row {i} {
+	return [lindex [_rows $this $i [expr {$i + 1}]] 0]
+}
 
-		set info [split [string range $p 0 [expr {$tab - 1}]] { }]
-		set path [string range $p [expr {$tab + 1}] end]
-		set type   [lindex $info 1]
-		set object [lindex $info 2]
+method _page_rows {} {
+	if {![winfo ismapped $w]} {
+		return [$w cget -height]
+	}
+	set h [font metrics [$w cget -font] -linespace]
+	if {$h < 18} {
+		set h 18; # the icons
+	}
+	set n [expr {[winfo height $w] / $h}]
+	return [expr {$n < 1 ? 1 : $n}]
+}
+
+method _clamp_top {} {
+	set max [expr {$list_count - [_page_rows $this]}]
+	if {$list_top > $max} {
+		set list_top $max
+	}
+	if {$list_top < 0} {
+		set list_top 0
+	}
+}
+
+# Puts the rows that are in view into the widget.
+#
+method _render {} {
+	_clamp_top $this
+	set page [_page_rows $this]
+	set first $list_top
+	set last [expr {$first + $page + 1}]
+	if {$last > $list_count} {
+		set last $list_count
+	}
+
+	$w conf -state normal
+	$w delete 0.0 end
+	set n 0
+	foreach info [_rows $this $first $last] {
+		set mode {}
+		switch -- [lindex $info 0] {
+		parent {
+			set type parent
+			set text [mc "\[Up To Parent\]"]
+		}
+		found {
+			set type [lindex $info 1]
+			set text [escape_path [lindex $info 2]]
+		}
+		default {
+			set type [lindex $info 0]
+			set text [escape_path [lindex $info 2]]
+			set mode [lindex $info 3]
+		}
+		}
 
 		switch -- $type {
+		parent {
+			set image ::browser::img_parent
+		}
 		blob {
-			scan [lindex $info 0] %o mode
-			if {$mode == 0120000} {
-				set image ::browser::img_symlink
-			} elseif {($mode & 0100) != 0} {
-				set image ::browser::img_xblob
-			} else {
-				set image ::browser::img_rblob
+			set image ::browser::img_rblob
+			if {$mode ne {}} {
+				scan $mode %o mode
+				if {$mode == 0120000} {
+					set image ::browser::img_symlink
+				} elseif {($mode & 0100) != 0} {
+					set image ::browser::img_xblob
+				}
 			}
 		}
 		tree {
 			set image ::browser::img_tree
-			append path /
 		}
 		default {
 			set image ::browser::img_unknown
@@ -245,25 +413,151 @@ method _read {fd} {
 			-align center -padx 5 -pady 1 \
 			-name icon[incr n] \
 			-image $image
-		$w insert end [escape_path $path]
-		lappend browser_files [list $type $object $path]
+		$w insert end $text
+	}
+	if {$list_sel >= $first && $list_sel < $last} {
+		set lno [expr {$list_sel - $first + 1}]
+		$w tag add in_sel $lno.0 [expr {$lno + 1}].0
 	}
 	$w conf -state disabled
 
+	if {$list_count > 0} {
+		$w_sby set \
+			[expr {double($first) / $list_count}] \
+			[expr {double(min($first + $page, $list_count)) / $list_count}]
+	} else {
+		$w_sby set 0 1
+	}
+}
+
+# Reads the listings of the subdirectories in the background, a few at a
+# time and only while nothing else is to be done, so that entering them
+# later is instant.
+#
+method _prefetch {tree} {
+	if {![winfo exists $w] || $tree ne $list_tree} return
+	if {[tree_store::prefetch $tree 4] > 0} {
+		set prefetch_id [after 20 [list after idle [cb _prefetch $tree]]]
+	}
+}
+
+# Starts reading all paths of the tree into the index behind "Go to
+# file", unless that was done before.
+#
+method _index {} {
+	set root [lindex $browser_stack 0 0]
+	if {$root eq {} || $goto_fd ne {}
+		|| [path_index::state $root] ne {none}} {
+		return
+	}
+	set goto_fd [git_read ls-tree -r -t -z --full-tree $root]
+	fconfigure $goto_fd -blocking 0 -translation binary
+	fileevent $goto_fd readable [cb _read_index $goto_fd $root]
+}
+
+method _read_index {fd root} {
+	path_index::add $root [read_fields $fd 1]
 	if {[eof $fd]} {
-		close $fd
-		set browser_status [mc "Ready."]
-		set browser_busy 0
-		set ls_buf {}
-		if {$n > 0} {
-			$w tag add in_sel 1.0 2.0
-			focus -force $w
+		fconfigure $fd -blocking 1
+		if {[catch {close $fd}]} {
+			path_index::drop $root
+		} else {
+			path_index::done $root
+		}
+		set goto_fd {}
+		if {$goto_text ne {} && [winfo exists $w]} {
+			_show_matches $this $goto_text
 		}
 	}
 } ifdeleted {
 	catch {close $fd}
 }
 
+method _goto_clear {} {
+	set goto_text {}
+	_goto_filter $this {}
+}
+
+method _goto_filter {P} {
+	if {$P eq {}} {
+		if {$browser_stack ne {}} {
+			set cur [lindex $browser_stack end]
+			set browser_stack [lrange $browser_stack 0 end-1]
+			_ls $this [lindex $cur 0] [lindex $cur 1]
+		}
+	} else {
+		_index $this
+		_show_matches $this $P
+	}
+	return 1
+}
+
+# Lists the best matches of the pattern among all paths of the tree.
+#
+method _show_matches {pat} {
+	variable goto_limit
+
+	after cancel $prefetch_id
+	set root [lindex $browser_stack 0 0]
+	set r [path_index::match $root $pat $goto_limit]
+	set total [lindex $r end]
+
+	set rows [list]
+	foreach {type path} [lrange $r 0 end-1] {
+		lappend rows [list found $type $path]
+	}
+	set list_parent 0
+	_show $this {} $rows
+
+	# Another browser of the same tree may be reading the paths. The
+	# matches are looked up again once it is done.
+	#
+	after cancel $goto_poll
+	set state [path_index::state $root]
+	if {$state eq {partial} && $goto_fd eq {}} {
+		set goto_poll [after 500 [cb _poll_index]]
+	}
+
+	if {$total eq {}} {
+		set browser_status [mc "Reading the file list..."]
+	} elseif {$state ne {complete}} {
+		set browser_status [mc "%s matching files so far, reading the file list..." $total]
+	} else {
+		set browser_status [mc "%s matching files" $total]
+	}
+}
+
+method _poll_index {} {
+	if {![winfo exists $w] || $goto_text eq {}} return
+	set root [lindex $browser_stack 0 0]
+	if {[path_index::state $root] eq {partial}} {
+		set goto_poll [after 500 [cb _poll_index]]
+		return
+	}
+	_index $this
+	_show_matches $this $goto_text
+}
+
+# Shows the directory with the path, going there from the top.
+#
+method _goto_dir {path} {
+	set root [lindex $browser_stack 0]
+	set browser_stack [list $root]
+	set p {}
+	set dirs [split $path /]
+	foreach d [lrange $dirs 0 end-1] {
+		append p $d/
+		lappend browser_stack [list \
+			[tree_store::fetch [lindex $root 0]:$p] \
+			$d/]
+	}
+	append p [lindex $dirs end]/
+	set goto_text {}
+	set browser_path "$browser_commit:[escape_path [lindex $root 1]$p]"
+	_ls $this [lindex $root 0]:$p [lindex $dirs end]/
+	focus $w
+}
+
 }
 
 class browser_open {
@@ -0,0 +1,123 @@
+// git-guing: shared git cat-file --batch process
+//
+// Objects are read from a single git cat-file --batch process that lives
+// as long as the application. Requests are written in batches that fit
+// into a pipe at once, so that git never blocks on its output while we
+// are still writing.
+
+#include "cat_file.h"
+#include "native.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+const size_t batch_size = 64;
+
+Tcl_Channel batch;
+
+bool open_batch(Tcl_Interp* interp)
+{
+	if (batch)
+		return true;
+	if (Tcl_Eval(interp, "git_read --input cat-file --batch") != TCL_OK)
+		return false;
+	batch = Tcl_GetChannel(interp, Tcl_GetStringResult(interp), nullptr);
+	Tcl_ResetResult(interp);
+	if (!batch)
+		return false;
+	Tcl_SetChannelOption(nullptr, batch, "-translation", "binary");
+	Tcl_SetChannelOption(nullptr, batch, "-blocking", "1");
+	Tcl_SetChannelOption(nullptr, batch, "-buffering", "full");
+	return true;
+}
+
+void close_batch(Tcl_Interp* interp)
+{
+	if (batch)
+		Tcl_UnregisterChannel(interp, batch);
+	batch = nullptr;
+}
+
+bool valid_header(const std::string& hdr, size_t sp1, size_t sp2)
+{
+	if (sp1 == 0 || sp1 == std::string::npos || sp1 == sp2 || sp2 + 1 == hdr.size())
+		return false;
+	if (!is_hex_id(hdr.substr(0, sp1)))
+		return false;
+	if (hdr.find_first_not_of("0123456789", sp2 + 1) != std::string::npos)
+		return false;
+	auto type = hdr.substr(sp1 + 1, sp2 - sp1 - 1);
+	return type == "blob" || type == "tree" || type == "commit" || type == "tag";
+}
+
+bool read_batch(const std::vector<std::string>& names, size_t first, size_t last,
+	std::vector<GitObject>& objects)
+{
+	std::string req;
+	for (size_t i = first; i < last; i++)
+	{
+		req += names[i];
+		req += '\n';
+	}
+	if (Tcl_Write(batch, req.data(), req.size()) < 0 || Tcl_Flush(batch) != TCL_OK)
+		return false;
+
+	Tcl_DString line;
+	Tcl_DStringInit(&line);
+	bool ok = true;
+	for (size_t i = first; ok && i < last; i++)
+	{
+		Tcl_DStringSetLength(&line, 0);
+		if (Tcl_Gets(batch, &line) < 0) {
+			ok = false;
+			break;
+		}
+		std::string hdr(Tcl_DStringValue(&line), Tcl_DStringLength(&line));
+		if (hdr == names[i] + " missing" || hdr == names[i] + " ambiguous")
+			continue;
+
+		// Anything but "<id> <type> <size>" means that we are out of
+		// step with git, and the process has to be started anew.
+		auto& o = objects[i];
+		auto sp1 = hdr.find(' ');
+		auto sp2 = hdr.rfind(' ');
+		if (!valid_header(hdr, sp1, sp2)) {
+			ok = false;
+			break;
+		}
+		o.data.assign(std::strtoul(hdr.c_str() + sp2 + 1, nullptr, 10) + 1, '\0');
+		if (Tcl_Read(batch, &o.data[0], o.data.size()) != int(o.data.size())) {
+			ok = false;
+			break;
+		}
+		o.data.pop_back();
+		o.id = hdr.substr(0, sp1);
+		o.type = hdr.substr(sp1 + 1, sp2 - sp1 - 1);
+	}
+	Tcl_DStringFree(&line);
+	return ok;
+}
+
+} // namespace
+
+bool cat_file(Tcl_Interp* interp, const std::vector<std::string>& names,
+	std::vector<GitObject>& objects)
+{
+	objects.assign(names.size(), GitObject());
+	for (size_t b = 0; b < names.size(); b += batch_size)
+	{
+		size_t e = std::min(names.size(), b + batch_size);
+		bool ok = false;
+		for (int attempt = 0; !ok && attempt < 2; attempt++)
+		{
+			std::fill(objects.begin() + b, objects.begin() + e, GitObject());
+			ok = open_batch(interp) && read_batch(names, b, e, objects);
+			if (!ok)
+				close_batch(interp);
+		}
+		if (!ok)
+			return false;
+	}
+	return true;
+}
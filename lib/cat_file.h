@@ -0,0 +1,21 @@
+// git-guing: shared git cat-file --batch process
+
+#pragma once
+
+#include <tcl.h>
+#include <string>
+#include <vector>
+
+struct GitObject
+{
+	std::string id;		// empty if the name did not resolve
+	std::string type;
+	std::string data;
+};
+
+// Reads the named objects from the repository. Names are anything that
+// git cat-file --batch understands, e.g. "HEAD^{tree}". The objects are
+// returned in the order of the names. Returns false if git could not be
+// asked.
+bool cat_file(Tcl_Interp* interp, const std::vector<std::string>& names,
+	std::vector<GitObject>& objects);
@@ -19,13 +19,13 @@ field cur_specs [list]; # list of specs for $revtype
 field spec_head       ; # list of all head specs
 field spec_trck       ; # list of all tracking branch specs
 field spec_tag        ; # list of all tag specs
-field tip_data        ; # array of tip commit info by refname
-field log_last        ; # array of reflog date by refname
 
 field tooltip_wm        {} ; # Current tooltip toplevel, if open
 field tooltip_t         {} ; # Text widget in $tooltip_wm
 field tooltip_timer     {} ; # Current timer event for our tooltip
 
+variable filter_limit 1000 ; # most specs listed at once
+
 proc new {path {title {}}} {
 	return [_new $path 0 $title]
 }
@@ -133,52 +133,33 @@ constructor _new {path unmerged_only title} {
 	bind $w_filter <Key-Return> [list focus $w_list]\;break
 	bind $w_filter <Key-Down>   [list focus $w_list]
 
-	set fmt list
-	append fmt { %(refname)}
-	append fmt { [list}
-	append fmt { %(objecttype)}
-	append fmt { %(objectname)}
-	append fmt { [concat %(taggername) %(authorname)]}
-	append fmt { [reformat_date [concat %(taggerdate) %(authordate)]]}
-	append fmt { %(subject)}
-	append fmt {] [list}
-	append fmt { %(*objecttype)}
-	append fmt { %(*objectname)}
-	append fmt { %(*authorname)}
-	append fmt { [reformat_date %(*authordate)]}
-	append fmt { %(*subject)}
-	append fmt {]}
+	# The ref store reads the refs only if they changed since it was
+	# asked last, and tells the commit store about the commits.
+	#
 	set all_refn [list]
-	set fr_fd [git_read for-each-ref \
-		--tcl \
-		--sort=-taggerdate \
-		--format=$fmt \
-		refs/heads \
-		refs/remotes \
-		refs/tags \
-		]
-	fconfigure $fr_fd -translation lf -encoding utf-8
-	while {[gets $fr_fd line] > 0} {
-		set line [eval $line]
-		if {[lindex $line 1 0] eq {tag}} {
-			if {[lindex $line 2 0] eq {commit}} {
-				set sha1 [lindex $line 2 1]
-			} else {
-				continue
-			}
-		} elseif {[lindex $line 1 0] eq {commit}} {
-			set sha1 [lindex $line 1 1]
-		} else {
-			continue
-		}
-		set refn [lindex $line 0]
-		set tip_data($refn) [lrange $line 1 end]
+	foreach {refn sha1} [ref_store::commits refs/heads refs/remotes refs/tags] {
 		lappend cmt_refn($sha1) $refn
 		lappend all_refn $refn
 	}
-	close $fr_fd
 
-	if {$unmerged_only} {
+	# Since git 2.7, for-each-ref --no-merged stops walking the history
+	# at the commits that are in HEAD. Older git lists all commits that
+	# are not, and the refs pointing to them are picked out.
+	#
+	if {$unmerged_only && [git-version >= 2.7]} {
+		set fr_fd [git_read for-each-ref \
+			--no-merged=$::HEAD \
+			--format=%(refname) \
+			refs/heads \
+			refs/remotes \
+			refs/tags \
+			]
+		fconfigure $fr_fd -translation lf -encoding utf-8
+		while {[gets $fr_fd refn] > 0} {
+			set inc($refn) 1
+		}
+		close $fr_fd
+	} elseif {$unmerged_only} {
 		set fr_fd [git_read rev-list --all ^$::HEAD]
 		while {[gets $fr_fd sha1] > 0} {
 			if {[catch {set rlst $cmt_refn($sha1)}]} continue
@@ -218,6 +199,17 @@ constructor _new {path unmerged_only title} {
 		}
 	}
 
+	# The names are matched against the filter natively, which ranks
+	# them and remembers the last matches while the user types.
+	#
+	foreach {type specs} [list head $spec_head trck $spec_trck tag $spec_tag] {
+		set names [list]
+		foreach spec $specs {
+			lappend names [lindex $spec 0]
+		}
+		name_index::set "$this $type" $names
+	}
+
 		  if {$is_detached}             { set revtype HEAD
 	} elseif {[llength $spec_head] > 0} { set revtype head
 	} elseif {[llength $spec_trck] > 0} { set revtype trck
@@ -227,7 +219,7 @@ constructor _new {path unmerged_only title} {
 
 	if {$revtype eq {head} && $current_branch ne {}} {
 		set i 0
-		foreach spec $spec_head {
+		foreach spec $cur_specs {
 			if {[lindex $spec 0] eq $current_branch} {
 				$w_list selection clear 0 end
 				$w_list selection set $i
@@ -339,7 +331,7 @@ method _expr {} {
 	trck -
 	tag  {
 		set i [$w_list curselection]
-		if {$i ne {}} {
+		if {$i ne {} && $i < [llength $cur_specs]} {
 			return [lindex $cur_specs $i 1]
 		} else {
 			error [mc "No revision selected."]
@@ -385,6 +377,8 @@ method _select {args} {
 }
 
 method _rebuild {pat} {
+	variable filter_limit
+
 	set ste normal
 	switch -- $revtype {
 	head { set new $spec_head }
@@ -403,16 +397,19 @@ method _rebuild {pat} {
 	}
 	$w_list delete 0 end
 
-	if {$pat ne {}} {
-		set pat *${pat}*
-	}
+	set r [name_index::match "$this $revtype" $pat $filter_limit]
 	set cur_specs [list]
-	foreach spec $new {
-		set txt [lindex $spec 0]
-		if {$pat eq {} || [string match $pat $txt]} {
-			lappend cur_specs $spec
-			$w_list insert end $txt
-		}
+	set names [list]
+	foreach i [lrange $r 0 end-1] {
+		set spec [lindex $new $i]
+		lappend cur_specs $spec
+		lappend names [lindex $spec 0]
+	}
+	$w_list insert end {*}$names
+	set more [expr {[lindex $r end] - [llength $cur_specs]}]
+	if {$more > 0} {
+		$w_list insert end [mc "(%s more, type to filter)" $more]
+		$w_list itemconfigure end -foreground gray
 	}
 	if {$cur_specs ne {}} {
 		$w_list selection clear 0 end
@@ -427,6 +424,9 @@ method _rebuild {pat} {
 
 method _delete {current} {
 	if {$current eq $w} {
+		foreach type {head trck tag} {
+			name_index::drop "$this $type"
+		}
 		delete_this
 	}
 }
@@ -520,7 +520,7 @@ method _open_tooltip {} {
 		$tooltip_t delete 0.0 end
 	}
 
-	set data $tip_data($refn)
+	set data [ref_store::tip $refn]
 	if {[lindex $data 0 0] eq {tag}} {
 		set tag  [lindex $data 0]
 		if {[lindex $data 1 0] eq {commit}} {
@@ -531,6 +531,9 @@ method _open_tooltip {} {
 	} elseif {[lindex $data 0 0] eq {commit}} {
 		set tag  {}
 		set cmit [lindex $data 0]
+	} else {
+		set tag  {}
+		set cmit {}
 	}
 
 	$tooltip_t insert end [lindex $spec 0]
@@ -547,7 +550,7 @@ method _open_tooltip {} {
 		$tooltip_t insert end [mc "Tag"] section_header
 		$tooltip_t insert end "  [lindex $tag 1]\n"
 		$tooltip_t insert end [lindex $tag 2]
-		$tooltip_t insert end " ([lindex $tag 3])\n"
+		$tooltip_t insert end " ([format_date [lindex $tag 3]])\n"
 		$tooltip_t insert end [lindex $tag 4]
 		$tooltip_t insert end "\n"
 	}
@@ -555,10 +558,11 @@ method _open_tooltip {} {
 	if {$cmit ne {}} {
 		$tooltip_t insert end "\n"
 		$tooltip_t insert end [mc "Commit@@noun"] section_header
-		$tooltip_t insert end "  [lindex $cmit 1]\n"
-		$tooltip_t insert end [lindex $cmit 2]
-		$tooltip_t insert end " ([lindex $cmit 3])\n"
-		$tooltip_t insert end [lindex $cmit 4]
+		set sha1 [lindex $cmit 1]
+		$tooltip_t insert end "  $sha1\n"
+		$tooltip_t insert end [commit_store::get $sha1 author]
+		$tooltip_t insert end " ([format_date [commit_store::get $sha1 author-time]])\n"
+		$tooltip_t insert end [commit_store::get $sha1 summary]
 	}
 
 	if {[llength $spec] > 2} {
@@ -576,26 +580,11 @@ method _open_tooltip {} {
 }
 
 method _reflog_last {name} {
-	if {[info exists reflog_last($name)]} {
-		return reflog_last($name)
-	}
-
-	set last {}
-	if {[catch {set last [file mtime [gitdir $name]]}]
-	&& ![catch {set g [open [gitdir logs $name] r]}]} {
-		fconfigure $g -translation binary
-		while {[gets $g line] >= 0} {
-			if {[regexp {> ([1-9][0-9]*) } $line line when]} {
-				set last $when
-			}
-		}
-		close $g
-	}
-
+	# Only the end of the reflog is read, and only if it changed.
+	set last [ref_store::updated $name]
 	if {$last ne {}} {
 		set last [format_date $last]
 	}
-	set reflog_last($name) $last
 	return $last
 }
 
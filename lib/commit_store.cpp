@@ -0,0 +1,328 @@
+// git-guing: process-wide store of commit metadata
+//
+// The blame viewer, the revision chooser and the file browser all show
+// who made a commit, when, and why. What any of them has learned about a
+// commit is kept here for all others. Missing commits are read in batches
+// through the shared git cat-file --batch process. Dates are kept as
+// seconds since the epoch, and text is kept converted from the commit's
+// encoding. The least recently used commits are dropped when the store
+// grows beyond its memory budget.
+
+#include "commit_store.h"
+#include "cat_file.h"
+#include "native.h"
+#include "text_input.h"
+#include <algorithm>
+#include <list>
+#include <map>
+#include <unordered_map>
+
+namespace {
+
+const size_t memory_budget = 32 << 20;
+
+struct Commit
+{
+	std::string id;
+	std::map<std::string, std::string> fields;
+	bool complete = false;	// all fields were read from the object
+	size_t bytes = 0;
+};
+
+std::list<Commit> lru;		// most recently used first
+std::unordered_map<std::string, std::list<Commit>::iterator> by_id;
+size_t used = 0;
+
+Commit& lookup(const std::string& id)
+{
+	auto it = by_id.find(id);
+	if (it != by_id.end()) {
+		lru.splice(lru.begin(), lru, it->second);
+		return *it->second;
+	}
+	lru.push_front(Commit());
+	lru.front().id = id;
+	lru.front().bytes = id.size() + 64;
+	used += lru.front().bytes;
+	by_id[id] = lru.begin();
+	return lru.front();
+}
+
+void account(Commit& c, long delta)
+{
+	c.bytes += delta;
+	used += delta;
+	while (used > memory_budget && lru.size() > 1) {
+		auto& old = lru.back();
+		used -= old.bytes;
+		by_id.erase(old.id);
+		lru.pop_back();
+	}
+}
+
+void set_field(Commit& c, const std::string& key, const std::string& value)
+{
+	auto& f = c.fields[key];
+	long delta = long(value.size()) - long(f.size());
+	if (f.empty() && !value.empty())
+		delta += key.size();
+	f = value;
+	account(c, delta);
+}
+
+// Sets the field unless it is known already. What git blame reported
+// has .mailmap applied, and its summary is the first line of the message;
+// both are kept when the commit object is read later.
+void fill_field(Commit& c, const std::string& key, const std::string& value)
+{
+	if (!c.fields.count(key))
+		set_field(c, key, value);
+}
+
+// Splits "Name <mail> 1234567890 +0100" into the fields git blame uses.
+void parse_ident(Commit& c, const std::string& who, const std::string& line)
+{
+	auto lt = line.find(" <");
+	auto gt = line.find("> ", lt == std::string::npos ? 0 : lt);
+	if (lt == std::string::npos || gt == std::string::npos) {
+		fill_field(c, who, line);
+		return;
+	}
+	fill_field(c, who, line.substr(0, lt));
+	fill_field(c, who + "-mail", line.substr(lt + 1, gt - lt));
+	auto rest = line.substr(gt + 2);
+	auto sp = rest.find(' ');
+	fill_field(c, who + "-time", rest.substr(0, sp));
+	if (sp != std::string::npos)
+		fill_field(c, who + "-tz", rest.substr(sp + 1));
+}
+
+Tcl_Encoding commit_encoding(Tcl_Interp* interp, const std::string& name)
+{
+	if (name.empty())
+		return Tcl_GetEncoding(nullptr, "utf-8");
+	Tcl_Obj* cmd[2] = { Tcl_NewStringObj("tcl_encoding", -1), tcl_obj(name) };
+	for (auto o : cmd)
+		Tcl_IncrRefCount(o);
+	Tcl_Encoding enc = nullptr;
+	if (Tcl_EvalObjv(interp, 2, cmd, TCL_EVAL_GLOBAL) == TCL_OK)
+		enc = Tcl_GetEncoding(nullptr, Tcl_GetString(Tcl_GetObjResult(interp)));
+	for (auto o : cmd)
+		Tcl_DecrRefCount(o);
+	Tcl_ResetResult(interp);
+	return enc;
+}
+
+// Fills the commit from the raw object. Fields that are known already
+// are kept, except for the message and the parents.
+void parse_commit(Tcl_Interp* interp, Commit& c, const std::string& raw)
+{
+	auto body = raw.find("\n\n");
+	std::string head = raw.substr(0, body);
+
+	std::string encoding;
+	for (size_t p = 0; p < head.size(); )
+	{
+		auto e = head.find('\n', p);
+		if (e == std::string::npos)
+			e = head.size();
+		if (head.compare(p, 9, "encoding ") == 0)
+			encoding = head.substr(p + 9, e - p - 9);
+		p = e + 1;
+	}
+
+	auto enc = commit_encoding(interp, encoding);
+	if (!enc)
+		enc = Tcl_GetEncoding(nullptr, "utf-8");
+	auto obj = decode_text(enc, raw.data(), raw.size());
+	Tcl_FreeEncoding(enc);
+	Tcl_IncrRefCount(obj);
+	std::string text = Tcl_GetString(obj);
+	Tcl_DecrRefCount(obj);
+
+	body = text.find("\n\n");
+	head = text.substr(0, body);
+	std::string msg = body == std::string::npos ? std::string() : text.substr(body + 2);
+
+	std::string parents;
+	for (size_t p = 0; p < head.size(); )
+	{
+		auto e = head.find('\n', p);
+		if (e == std::string::npos)
+			e = head.size();
+		auto line = head.substr(p, e - p);
+		p = e + 1;
+		if (line.compare(0, 7, "parent ") == 0) {
+			if (!parents.empty())
+				parents += ' ';
+			parents += line.substr(7);
+		} else if (line.compare(0, 7, "author ") == 0) {
+			parse_ident(c, "author", line.substr(7));
+		} else if (line.compare(0, 10, "committer ") == 0) {
+			parse_ident(c, "committer", line.substr(10));
+		}
+	}
+	set_field(c, "parents", parents);
+
+	auto first = msg.find_first_not_of(" \t\n");
+	auto last = msg.find_last_not_of(" \t\n");
+	msg = first == std::string::npos ? std::string() : msg.substr(first, last - first + 1);
+	set_field(c, "message", msg);
+
+	// The subject is the first paragraph, joined into one line.
+	auto para = msg.find("\n\n");
+	std::string summary = msg.substr(0, para);
+	std::replace(summary.begin(), summary.end(), '\n', ' ');
+	fill_field(c, "summary", summary);
+
+	c.complete = true;
+}
+
+// Makes sure the named commits are complete in the store, and returns
+// their ids.
+std::vector<std::string> fetch(Tcl_Interp* interp, const std::vector<std::string>& names)
+{
+	std::vector<std::string> ids(names.size());
+	std::vector<std::string> todo;
+	std::vector<size_t> where;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		auto it = by_id.find(names[i]);
+		if (it != by_id.end() && it->second->complete) {
+			ids[i] = names[i];
+		} else {
+			todo.push_back(names[i]);
+			where.push_back(i);
+		}
+	}
+
+	for (auto& n : todo)
+		if (!is_hex_id(n))
+			n += "^{commit}";
+	std::vector<GitObject> objects;
+	cat_file(interp, todo, objects);
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		auto& o = objects[i];
+		if (o.type == "commit") {
+			ids[where[i]] = o.id;
+			parse_commit(interp, lookup(o.id), o.data);
+		}
+	}
+	Tcl_ResetResult(interp);
+	return ids;
+}
+
+std::vector<std::string> string_list(Tcl_Interp* interp, Tcl_Obj* list, bool& ok)
+{
+	Tcl_Obj** elems;
+	int n;
+	std::vector<std::string> r;
+	ok = Tcl_ListObjGetElements(interp, list, &n, &elems) == TCL_OK;
+	for (int i = 0; ok && i < n; i++)
+		r.push_back(tcl_string(elems[i]));
+	return r;
+}
+
+// commit_store::fetch names
+// Reads all of the named commits that are not completely known yet in
+// one go, and returns their ids; the id of a name that is no commit is
+// empty.
+int cmd_fetch(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "names");
+		return TCL_ERROR;
+	}
+	bool ok;
+	auto names = string_list(interp, objv[1], ok);
+	if (!ok)
+		return TCL_ERROR;
+	auto result = Tcl_NewListObj(0, nullptr);
+	for (auto& id : fetch(interp, names))
+		Tcl_ListObjAppendElement(nullptr, result, tcl_obj(id));
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// commit_store::get name ?field?
+// Returns a field of the commit, or all known fields as a list of names
+// and values. Fields are author, author-mail, author-time, author-tz,
+// the same for committer, summary, message and parents. The commit is
+// read from the repository if the field is not known yet. Returns an
+// empty string if there is no such commit or field.
+int cmd_get(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2 && objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "name ?field?");
+		return TCL_ERROR;
+	}
+	auto id = tcl_string(objv[1]);
+	std::string key = objc == 3 ? tcl_string(objv[2]) : std::string();
+
+	auto it = by_id.find(id);
+	bool known = it != by_id.end() && (it->second->complete
+		|| (!key.empty() && it->second->fields.count(key)));
+	if (!known) {
+		id = fetch(interp, {id})[0];
+		it = by_id.find(id);
+		if (it == by_id.end())
+			return TCL_OK;
+	}
+
+	auto& c = lookup(id);
+	if (!key.empty()) {
+		auto f = c.fields.find(key);
+		if (f != c.fields.end())
+			Tcl_SetObjResult(interp, tcl_obj(f->second));
+		return TCL_OK;
+	}
+	auto result = Tcl_NewListObj(0, nullptr);
+	for (auto& f : c.fields)
+	{
+		Tcl_ListObjAppendElement(nullptr, result, tcl_obj(f.first));
+		Tcl_ListObjAppendElement(nullptr, result, tcl_obj(f.second));
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// commit_store::learn id field value ?field value ...?
+// Records fields of the commit that were learned elsewhere.
+int cmd_learn(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc < 4 || objc % 2 != 0) {
+		Tcl_WrongNumArgs(interp, 1, objv, "id field value ?field value ...?");
+		return TCL_ERROR;
+	}
+	auto id = tcl_string(objv[1]);
+	for (int i = 2; i < objc; i += 2)
+		commit_learn(id, tcl_string(objv[i]), tcl_string(objv[i + 1]));
+	return TCL_OK;
+}
+
+} // namespace
+
+void commit_learn(const std::string& id, const std::string& key,
+	const std::string& value)
+{
+	auto& c = lookup(id);
+	if (!c.complete || !c.fields.count(key))
+		set_field(c, key, value);
+}
+
+std::vector<std::pair<std::string, std::string>> commit_fields(const std::string& id)
+{
+	std::vector<std::pair<std::string, std::string>> r;
+	auto it = by_id.find(id);
+	if (it != by_id.end())
+		r.assign(it->second->fields.begin(), it->second->fields.end());
+	return r;
+}
+
+void commit_store_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "commit_store::fetch", cmd_fetch, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "commit_store::get", cmd_get, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "commit_store::learn", cmd_learn, nullptr, nullptr);
+}
@@ -0,0 +1,18 @@
+// git-guing: process-wide store of commit metadata
+
+#pragma once
+
+#include <tcl.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Records a field of the commit as reported by git blame, e.g. author or
+// author-time. Fields are named as in git blame --incremental output.
+void commit_learn(const std::string& id, const std::string& key,
+	const std::string& value);
+
+// The fields that are known of the commit.
+std::vector<std::pair<std::string, std::string>> commit_fields(const std::string& id);
+
+void commit_store_init(Tcl_Interp* interp);
@@ -19,14 +19,17 @@ proc apply_tab_size {{firsttab {}}} {
 
 proc clear_diff {} {
 	global ui_diff current_diff_path current_diff_header
-	global ui_index ui_workdir
+	global ui_index ui_workdir diff_hunk_selection diff_preview_id
 
 	$ui_diff conf -state normal
 	$ui_diff delete 0.0 end
 	$ui_diff conf -state disabled
+	diff_model::clear
 
 	set current_diff_path {}
 	set current_diff_header {}
+	set diff_hunk_selection [list]
+	incr diff_preview_id
 
 	$ui_index tag remove in_diff 0.0 end
 	$ui_workdir tag remove in_diff 0.0 end
@@ -37,6 +40,8 @@ proc reshow_diff {{after {}}} {
 	global current_diff_path current_diff_side
 	global ui_diff
 
+	flush_display_files
+
 	set p $current_diff_path
 	if {$p eq {}} {
 		# No diff is being shown.
@@ -65,6 +70,41 @@ proc force_diff_encoding {enc} {
 	}
 }
 
+proc diff_yscroll {sb first last} {
+	$sb set $first $last
+	schedule_word_diff
+}
+
+proc schedule_word_diff {} {
+	global word_diff_pending
+
+	if {!$word_diff_pending} {
+		set word_diff_pending 1
+		after idle show_word_diff
+	}
+}
+
+# Highlights the changed words in the hunks that are visible. Hunks that
+# never scroll into view are not examined.
+proc show_word_diff {} {
+	global ui_diff diff_active word_diff_pending
+	global is_3way_diff is_submodule_diff
+
+	set word_diff_pending 0
+	if {$diff_active || $is_3way_diff || $is_submodule_diff
+	    || [is_config_false gui.worddiff]} return
+
+	set top [lindex [split [$ui_diff index @0,0] .] 0]
+	set bot [lindex [split [$ui_diff index @0,[winfo height $ui_diff]] .] 0]
+	foreach {old_idx new_idx} [diff_model::word_diff $top $bot] break
+	if {$old_idx ne {}} {
+		eval [list $ui_diff tag add d_wdel] $old_idx
+	}
+	if {$new_idx ne {}} {
+		eval [list $ui_diff tag add d_wadd] $new_idx
+	}
+}
+
 proc handle_empty_diff {} {
 	global current_diff_path file_states file_lists
 	global diff_empty_count
@@ -97,6 +137,8 @@ proc show_diff {path w {lno {}} {scroll_pos {}} {callback {}}} {
 	global current_diff_path current_diff_side current_diff_header
 	global current_diff_queue
 
+	flush_display_files
+
 	if {$diff_active || ![lock_index read]} return
 
 	clear_diff
@@ -186,12 +228,14 @@ proc show_other_diff {path w m cont_info} {
 	global is_3way_diff diff_active repo_config
 	global ui_diff ui_index ui_workdir
 	global current_diff_path current_diff_side current_diff_header
+	global diff_preview_id
 
 	# - Git won't give us the diff, there's nothing to compare to!
 	#
 	if {$m eq {_O}} {
-		set max_sz 100000
+		set max_sz [get_config gui.maxpreviewsize]
 		set type unknown
+		set binary 0
 		if {[catch {
 				set type [file type $path]
 				switch -- $type {
@@ -203,15 +247,16 @@ proc show_other_diff {path w m cont_info} {
 				link {
 					set content [file readlink $path]
 					set sz [string length $content]
+					set binary [expr {[string first "\0" $content] != -1}]
 				}
 				file {
-					set fd [open $path r]
-					fconfigure $fd \
-						-eofchar {} \
-						-encoding [get_path_encoding $path]
-					set content [read $fd $max_sz]
-					close $fd
-					set sz [file size $path]
+					# Only the first $max_sz bytes are ever read,
+					# and nothing at all of binary files.
+					set enc [get_path_encoding $path]
+					foreach {sz content binary} \
+						[preview_file $path $max_sz \
+							[expr {$enc eq {utf-8}}]] break
+					set content [decode_text $content $enc]
 				}
 				default {
 					error "'$type' not supported"
@@ -237,40 +282,68 @@ proc show_other_diff {path w m cont_info} {
 			}
 			$ui_diff insert end "* $type\n" d_info
 		}
-		if {[string first "\0" $content] != -1} {
+		if {$binary} {
 			$ui_diff insert end \
 				[mc "* Binary file (not showing content)."] \
 				d_info
-		} else {
-			if {$sz > $max_sz} {
-				$ui_diff insert end [mc \
+			set content {}
+		} elseif {$sz > $max_sz} {
+			$ui_diff insert end [mc \
 "* Untracked file is %d bytes.
 * Showing only first %d bytes.
 " $sz $max_sz] d_info
-			}
-			$ui_diff insert end $content
-			if {$sz > $max_sz} {
-				$ui_diff insert end [mc "
-* Untracked file clipped here by %s.
-* To see the entire file, use an external editor.
-" [appname]] d_info
-			}
 		}
 		$ui_diff conf -state disabled
+
+		set clipped [expr {!$binary && $sz > $max_sz}]
+		_show_other_content [incr diff_preview_id] \
+			$content 0 $clipped $cont_info
+		return
+	}
+}
+
+# Inserts the content of an untracked file in chunks, so that the UI stays
+# responsive while large files are shown.
+proc _show_other_content {id content pos clipped cont_info} {
+	global ui_diff diff_active diff_preview_id
+
+	# The preview was abandoned by clear_diff.
+	if {$id != $diff_preview_id} {
 		set diff_active 0
 		unlock_index
-		set scroll_pos [lindex $cont_info 0]
-		if {$scroll_pos ne {}} {
-			update
-			$ui_diff yview moveto $scroll_pos
-		}
-		ui_ready
-		set callback [lindex $cont_info 1]
-		if {$callback ne {}} {
-			eval $callback
-		}
 		return
 	}
+
+	set chunk 65536
+	set end [expr {$pos + $chunk}]
+	$ui_diff conf -state normal
+	$ui_diff insert end [string range $content $pos [expr {$end - 1}]]
+	if {$end < [string length $content]} {
+		$ui_diff conf -state disabled
+		after 1 [list _show_other_content $id $content $end \
+			$clipped $cont_info]
+		return
+	}
+	if {$clipped} {
+		$ui_diff insert end [mc "
+* Untracked file clipped here by %s.
+* To see the entire file, use an external editor.
+" [appname]] d_info
+	}
+	$ui_diff conf -state disabled
+
+	set diff_active 0
+	unlock_index
+	set scroll_pos [lindex $cont_info 0]
+	if {$scroll_pos ne {}} {
+		update
+		$ui_diff yview moveto $scroll_pos
+	}
+	ui_ready
+	set callback [lindex $cont_info 1]
+	if {$callback ne {}} {
+		eval $callback
+	}
 }
 
 proc get_conflict_marker_size {path} {
@@ -365,9 +438,9 @@ proc start_show_diff {cont_info {add_opts {}}} {
 	set ::current_diff_inheader 1
 	fconfigure $fd \
 		-blocking 0 \
-		-encoding [get_path_encoding $path] \
-		-translation lf
-	fileevent $fd readable [list read_diff $fd $conflict_size $cont_info]
+		-translation binary
+	fileevent $fd readable [list read_diff $fd \
+		[get_path_encoding $path] $conflict_size $cont_info]
 }
 
 proc parse_color_line {line} {
@@ -395,14 +468,16 @@ proc parse_color_line {line} {
 	return [list $result $markup]
 }
 
-proc read_diff {fd conflict_size cont_info} {
+proc read_diff {fd enc conflict_size cont_info} {
 	global ui_diff diff_active is_submodule_diff
 	global is_3way_diff is_conflict_diff current_diff_header
 	global current_diff_queue
 	global diff_empty_count
 
 	$ui_diff conf -state normal
-	while {[gets $fd line] >= 0} {
+	set model_lno [lindex [split [$ui_diff index {end - 1 lines}] .] 0]
+	set model_lines [list]
+	foreach line [read_lines $fd $enc] {
 		foreach {line markup} [parse_color_line $line] break
 		set line [string map {\033 ^} $line]
 
@@ -526,6 +601,7 @@ proc read_diff {fd conflict_size cont_info} {
 			$ui_diff tag add d_cr {end - 2c}
 		}
 		$ui_diff insert end "\n" $tags
+		lappend model_lines $line
 
 		foreach {posbegin colbegin posend colend} $markup {
 			set prefix clr
@@ -539,6 +615,7 @@ proc read_diff {fd conflict_size cont_info} {
 		}
 	}
 	$ui_diff conf -state disabled
+	diff_model::append $model_lno $model_lines
 
 	if {[eof $fd]} {
 		close $fd
@@ -556,6 +633,7 @@ proc read_diff {fd conflict_size cont_info} {
 			$ui_diff yview moveto $scroll_pos
 		}
 		ui_ready
+		schedule_word_diff
 
 		if {[$ui_diff index end] eq {2.0}} {
 			handle_empty_diff
@@ -571,39 +649,105 @@ proc read_diff {fd conflict_size cont_info} {
 }
 
 proc apply_hunk {x y} {
+	global ui_diff
+
+	set lno [lindex [split [$ui_diff index @$x,$y] .] 0]
+	set hunk [diff_model::hunk $lno]
+	if {$hunk ne {}} {
+		apply_hunks [list [lindex $hunk 0]]
+	}
+}
+
+proc toggle_hunk_selection {x y} {
+	global ui_diff diff_hunk_selection
+
+	set lno [lindex [split [$ui_diff index @$x,$y] .] 0]
+	set hunk [diff_model::hunk $lno]
+	if {$hunk eq {}} return
+	foreach {s_lno e_lno} $hunk break
+
+	set i [lsearch -exact $diff_hunk_selection $s_lno]
+	if {$i >= 0} {
+		set diff_hunk_selection [lreplace $diff_hunk_selection $i $i]
+		$ui_diff tag remove d_hunksel $s_lno.0 $e_lno.0
+	} else {
+		lappend diff_hunk_selection $s_lno
+		$ui_diff tag add d_hunksel $s_lno.0 $e_lno.0
+	}
+}
+
+proc select_hunks_containing_selection {} {
+	global ui_diff diff_hunk_selection
+
+	if {[catch {set text [$ui_diff get sel.first sel.last]}]} return
+	set found [diff_model::find_hunks $text]
+	foreach {s_lno e_lno} [diff_model::hunk_ranges $found] {
+		if {[lsearch -exact $diff_hunk_selection $s_lno] < 0} {
+			lappend diff_hunk_selection $s_lno
+		}
+		$ui_diff tag add d_hunksel $s_lno.0 $e_lno.0
+	}
+}
+
+proc clear_hunk_selection {} {
+	global ui_diff diff_hunk_selection
+
+	set diff_hunk_selection [list]
+	$ui_diff tag remove d_hunksel 0.0 end
+}
+
+proc apply_hunk_selection {} {
+	global diff_hunk_selection
+
+	if {$diff_hunk_selection ne {}} {
+		apply_hunks $diff_hunk_selection
+	}
+}
+
+# Stages (or unstages) all hunks whose header lines are listed in headers
+# with a single invocation of git apply.
+proc apply_hunks {headers} {
 	global current_diff_path current_diff_header current_diff_side
 	global ui_diff ui_index file_states
 
 	if {$current_diff_path eq {} || $current_diff_header eq {}} return
 	if {![lock_index apply_hunk]} return
 
+	set ranges [diff_model::hunk_ranges $headers]
+	if {$ranges eq {}} {
+		unlock_index
+		return
+	}
+	set many [expr {[llength $ranges] > 2}]
+
 	set apply_cmd {apply --cached --whitespace=nowarn}
 	set mi [lindex $file_states($current_diff_path) 0]
 	if {$current_diff_side eq $ui_index} {
-		set failed_msg [mc "Failed to unstage selected hunk."]
+		if {$many} {
+			set failed_msg [mc "Failed to unstage selected hunks."]
+		} else {
+			set failed_msg [mc "Failed to unstage selected hunk."]
+		}
 		lappend apply_cmd --reverse
 		if {[string index $mi 0] ne {M}} {
 			unlock_index
 			return
 		}
 	} else {
-		set failed_msg [mc "Failed to stage selected hunk."]
+		if {$many} {
+			set failed_msg [mc "Failed to stage selected hunks."]
+		} else {
+			set failed_msg [mc "Failed to stage selected hunk."]
+		}
 		if {[string index $mi 1] ne {M}} {
 			unlock_index
 			return
 		}
 	}
 
-	set s_lno [lindex [split [$ui_diff index @$x,$y] .] 0]
-	set s_lno [$ui_diff search -backwards -regexp ^@@ $s_lno.0 0.0]
-	if {$s_lno eq {}} {
-		unlock_index
-		return
-	}
-
-	set e_lno [$ui_diff search -forwards -regexp ^@@ "$s_lno + 1 lines" end]
-	if {$e_lno eq {}} {
-		set e_lno end
+	set patch {}
+	foreach {s_lno e_lno} $ranges {
+		append patch [diff_model::get $s_lno $e_lno]
 	}
 
 	if {[catch {
@@ -611,18 +755,24 @@ proc apply_hunk {x y} {
 		set p [eval git_write $apply_cmd]
 		fconfigure $p -translation binary -encoding $enc
 		puts -nonewline $p $current_diff_header
-		puts -nonewline $p [$ui_diff get $s_lno $e_lno]
+		puts -nonewline $p $patch
 		close $p} err]} {
 		error_popup "$failed_msg\n\n$err"
 		unlock_index
 		return
 	}
 
+	# Remove the hunks bottom-up so that the line numbers of the
+	# remaining ranges stay valid.
+	clear_hunk_selection
 	$ui_diff conf -state normal
-	$ui_diff delete $s_lno $e_lno
+	foreach {e_lno s_lno} [lreverse $ranges] {
+		$ui_diff delete $s_lno.0 $e_lno.0
+		diff_model::delete $s_lno $e_lno
+	}
 	$ui_diff conf -state disabled
 
-	if {[$ui_diff get 1.0 end] eq "\n"} {
+	if {[$ui_diff index end] eq {2.0}} {
 		set o _
 	} else {
 		set o ?
@@ -657,8 +807,8 @@ proc apply_range_or_line {x y} {
 		set last [lindex $selected 1]
 	}
 
-	set first_l [$ui_diff index "$first linestart"]
-	set last_l [$ui_diff index "$last lineend"]
+	set first_l [lindex [split [$ui_diff index $first] .] 0]
+	set last_l [lindex [split [$ui_diff index $last] .] 0]
 
 	if {$current_diff_path eq {} || $current_diff_header eq {}} return
 	if {![lock_index apply_hunk]} return
@@ -682,147 +832,12 @@ proc apply_range_or_line {x y} {
 		}
 	}
 
-	set wholepatch {}
-
-	while {$first_l < $last_l} {
-		set i_l [$ui_diff search -backwards -regexp ^@@ $first_l 0.0]
-		if {$i_l eq {}} {
-			# If there's not a @@ above, then the selected range
-			# must have come before the first_l @@
-			set i_l [$ui_diff search -regexp ^@@ $first_l $last_l]
-		}
-		if {$i_l eq {}} {
-			unlock_index
-			return
-		}
-		# $i_l is now at the beginning of a line
-
-		# pick start line number from hunk header
-		set hh [$ui_diff get $i_l "$i_l + 1 lines"]
-		set hh [lindex [split $hh ,] 0]
-		set hln [lindex [split $hh -] 1]
-		set hln [lindex [split $hln " "] 0]
-
-		# There is a special situation to take care of. Consider this
-		# hunk:
-		#
-		#    @@ -10,4 +10,4 @@
-		#     context before
-		#    -old 1
-		#    -old 2
-		#    +new 1
-		#    +new 2
-		#     context after
-		#
-		# We used to keep the context lines in the order they appear in
-		# the hunk. But then it is not possible to correctly stage only
-		# "-old 1" and "+new 1" - it would result in this staged text:
-		#
-		#    context before
-		#    old 2
-		#    new 1
-		#    context after
-		#
-		# (By symmetry it is not possible to *un*stage "old 2" and "new
-		# 2".)
-		#
-		# We resolve the problem by introducing an asymmetry, namely,
-		# when a "+" line is *staged*, it is moved in front of the
-		# context lines that are generated from the "-" lines that are
-		# immediately before the "+" block. That is, we construct this
-		# patch:
-		#
-		#    @@ -10,4 +10,5 @@
-		#     context before
-		#    +new 1
-		#     old 1
-		#     old 2
-		#     context after
-		#
-		# But we do *not* treat "-" lines that are *un*staged in a
-		# special way.
-		#
-		# With this asymmetry it is possible to stage the change "old
-		# 1" -> "new 1" directly, and to stage the change "old 2" ->
-		# "new 2" by first staging the entire hunk and then unstaging
-		# the change "old 1" -> "new 1".
-		#
-		# Applying multiple lines adds complexity to the special
-		# situation.  The pre_context must be moved after the entire
-		# first block of consecutive staged "+" lines, so that
-		# staging both additions gives the following patch:
-		#
-		#    @@ -10,4 +10,6 @@
-		#     context before
-		#    +new 1
-		#    +new 2
-		#     old 1
-		#     old 2
-		#     context after
-
-		# This is non-empty if and only if we are _staging_ changes;
-		# then it accumulates the consecutive "-" lines (after
-		# converting them to context lines) in order to be moved after
-		# "+" change lines.
-		set pre_context {}
-
-		set n 0
-		set m 0
-		set i_l [$ui_diff index "$i_l + 1 lines"]
-		set patch {}
-		while {[$ui_diff compare $i_l < "end - 1 chars"] &&
-		       [$ui_diff get $i_l "$i_l + 2 chars"] ne {@@}} {
-			set next_l [$ui_diff index "$i_l + 1 lines"]
-			set c1 [$ui_diff get $i_l]
-			if {[$ui_diff compare $first_l <= $i_l] &&
-			    [$ui_diff compare $i_l < $last_l] &&
-			    ($c1 eq {-} || $c1 eq {+})} {
-				# a line to stage/unstage
-				set ln [$ui_diff get $i_l $next_l]
-				if {$c1 eq {-}} {
-					set n [expr $n+1]
-					set patch "$patch$pre_context$ln"
-					set pre_context {}
-				} else {
-					set m [expr $m+1]
-					set patch "$patch$ln"
-				}
-			} elseif {$c1 ne {-} && $c1 ne {+}} {
-				# context line
-				set ln [$ui_diff get $i_l $next_l]
-				set patch "$patch$pre_context$ln"
-				# Skip the "\ No newline at end of
-				# file". Depending on the locale setting
-				# we don't know what this line looks
-				# like exactly. The only thing we do
-				# know is that it starts with "\ "
-				if {![string match {\\ *} $ln]} {
-					set n [expr $n+1]
-					set m [expr $m+1]
-				}
-				set pre_context {}
-			} elseif {$c1 eq $to_context} {
-				# turn change line into context line
-				set ln [$ui_diff get "$i_l + 1 chars" $next_l]
-				if {$c1 eq {-}} {
-					set pre_context "$pre_context $ln"
-				} else {
-					set patch "$patch $ln"
-				}
-				set n [expr $n+1]
-				set m [expr $m+1]
-			} else {
-				# a change in the opposite direction of
-				# to_context which is outside the range of
-				# lines to apply.
-				set patch "$patch$pre_context"
-				set pre_context {}
-			}
-			set i_l $next_l
-		}
-		set patch "$patch$pre_context"
-		set wholepatch "$wholepatch@@ -$hln,$n +$hln,$m @@\n$patch"
-		set first_l [$ui_diff index "$next_l + 1 lines"]
+	# The patch is built from the diff model; see range_patch in
+	# diff_model.cpp for how the context lines are arranged.
+	set wholepatch [diff_model::range_patch $first_l $last_l $to_context]
+	if {$wholepatch eq {}} {
+		unlock_index
+		return
 	}
 
 	if {[catch {
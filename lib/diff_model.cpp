@@ -0,0 +1,551 @@
+// git-guing: in-memory model of the displayed diff
+//
+// The diff viewer keeps a copy of every line that it inserts into $ui_diff
+// here, so that patches for hunks and single lines can be constructed
+// without walking the text widget. Line numbers on the Tcl side are the
+// line numbers of the text widget, i.e., they start at 1.
+
+#include "diff_model.h"
+#include "native.h"
+#include "word_diff.h"
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+struct Hunk
+{
+	int line;		// index of the "@@" line
+	int old_start;		// the line number after "-" in the header
+	bool words_done;	// word differences were computed
+};
+
+struct DiffModel
+{
+	std::vector<std::string> lines;
+	std::vector<Hunk> hunks;	// sorted by line
+
+	void clear()
+	{
+		lines.clear();
+		hunks.clear();
+	}
+
+	bool is_header(int i) const
+	{
+		return lines[i].compare(0, 2, "@@") == 0;
+	}
+
+	// The hunk whose header is the last one before line i.
+	std::vector<Hunk>::const_iterator hunk_before(int i) const
+	{
+		auto h = std::lower_bound(hunks.begin(), hunks.end(), i,
+			[](const Hunk& h, int i) { return h.line < i; });
+		return h == hunks.begin() ? hunks.end() : h - 1;
+	}
+
+	// The line index where the hunk with header line i ends.
+	int hunk_end(int i) const
+	{
+		auto h = std::upper_bound(hunks.begin(), hunks.end(), i,
+			[](int i, const Hunk& h) { return i < h.line; });
+		return h == hunks.end() ? int(lines.size()) : h->line;
+	}
+
+	void append(int at, const std::vector<std::string>& new_lines);
+	void erase(int first, int last);
+	std::string range_patch(int first, int last, char to_context) const;
+	bool hunk_contains(int header, const std::string& text, bool nocase) const;
+	void hunk_word_diff(int header, std::string& old_idx, std::string& new_idx) const;
+};
+
+int parse_old_start(const std::string& hh)
+{
+	// Equivalent to splitting "@@ -10,4 +10,4 @@" at ",", "-", and " ".
+	auto pos = hh.find('-');
+	if (pos == std::string::npos)
+		return 0;
+	int n = 0;
+	for (++pos; pos < hh.size() && hh[pos] >= '0' && hh[pos] <= '9'; ++pos)
+		n = n * 10 + (hh[pos] - '0');
+	return n;
+}
+
+void DiffModel::append(int at, const std::vector<std::string>& new_lines)
+{
+	// Text that was inserted into the widget without going through
+	// the model (e.g., the headings of conflict diffs) is represented
+	// by empty lines.
+	if (at > int(lines.size()))
+		lines.resize(at);
+	else
+		lines.erase(lines.begin() + at, lines.end());
+	hunks.erase(std::lower_bound(hunks.begin(), hunks.end(), at,
+			[](const Hunk& h, int i) { return h.line < i; }),
+		hunks.end());
+
+	for (const auto& l: new_lines)
+	{
+		int i = lines.size();
+		lines.push_back(l);
+		if (is_header(i))
+			hunks.push_back({ i, parse_old_start(l), false });
+	}
+}
+
+void DiffModel::erase(int first, int last)
+{
+	first = std::max(0, std::min(first, int(lines.size())));
+	last = std::max(first, std::min(last, int(lines.size())));
+	lines.erase(lines.begin() + first, lines.begin() + last);
+
+	std::vector<Hunk> kept;
+	kept.reserve(hunks.size());
+	for (auto h: hunks)
+	{
+		if (h.line < first) {
+			kept.push_back(h);
+		} else if (h.line >= last) {
+			h.line -= last - first;
+			kept.push_back(h);
+		}
+	}
+	hunks.swap(kept);
+}
+
+// Builds the patch that stages (to_context is '-') or unstages (to_context
+// is '+') the lines first..last of the widget.
+//
+// There is a special situation to take care of. Consider this
+// hunk:
+//
+//    @@ -10,4 +10,4 @@
+//     context before
+//    -old 1
+//    -old 2
+//    +new 1
+//    +new 2
+//     context after
+//
+// We used to keep the context lines in the order they appear in
+// the hunk. But then it is not possible to correctly stage only
+// "-old 1" and "+new 1" - it would result in this staged text:
+//
+//    context before
+//    old 2
+//    new 1
+//    context after
+//
+// (By symmetry it is not possible to *un*stage "old 2" and "new
+// 2".)
+//
+// We resolve the problem by introducing an asymmetry, namely,
+// when a "+" line is *staged*, it is moved in front of the
+// context lines that are generated from the "-" lines that are
+// immediately before the "+" block. That is, we construct this
+// patch:
+//
+//    @@ -10,4 +10,5 @@
+//     context before
+//    +new 1
+//     old 1
+//     old 2
+//     context after
+//
+// But we do *not* treat "-" lines that are *un*staged in a
+// special way.
+//
+// With this asymmetry it is possible to stage the change "old
+// 1" -> "new 1" directly, and to stage the change "old 2" ->
+// "new 2" by first staging the entire hunk and then unstaging
+// the change "old 1" -> "new 1".
+//
+// Applying multiple lines adds complexity to the special
+// situation.  The pre_context must be moved after the entire
+// first block of consecutive staged "+" lines, so that
+// staging both additions gives the following patch:
+//
+//    @@ -10,4 +10,6 @@
+//     context before
+//    +new 1
+//    +new 2
+//     old 1
+//     old 2
+//     context after
+std::string DiffModel::range_patch(int first, int last, char to_context) const
+{
+	int nlines = lines.size();
+	// A selection that ends at the start of an empty line does not
+	// include that line.
+	auto in_range = [&](int i) {
+		return first <= i && (i < last || (i == last && i < nlines && !lines[i].empty()));
+	};
+
+	std::string wholepatch;
+	while (in_range(first)) {
+		auto h = hunk_before(first);
+		if (h == hunks.end()) {
+			// If there's not a @@ above, then the selected range
+			// must have come before the first @@
+			for (h = hunks.begin(); h != hunks.end() && h->line < first; ++h)
+				;
+			if (h == hunks.end() || !in_range(h->line))
+				return {};
+		}
+
+		// This is non-empty if and only if we are _staging_ changes;
+		// then it accumulates the consecutive "-" lines (after
+		// converting them to context lines) in order to be moved after
+		// "+" change lines.
+		std::string pre_context;
+		std::string patch;
+		int n = 0, m = 0;
+		int i = h->line + 1;
+		for (; i < nlines && !is_header(i); ++i)
+		{
+			const auto& l = lines[i];
+			char c1 = l.empty() ? '\n' : l[0];
+			if (in_range(i) && (c1 == '-' || c1 == '+')) {
+				// a line to stage/unstage
+				if (c1 == '-') {
+					++n;
+					patch += pre_context;
+					pre_context.clear();
+				} else {
+					++m;
+				}
+				patch += l;
+				patch += '\n';
+			} else if (c1 != '-' && c1 != '+') {
+				// context line
+				patch += pre_context;
+				patch += l;
+				patch += '\n';
+				// Skip the "\ No newline at end of file".
+				if (l.compare(0, 2, "\\ ") != 0) {
+					++n;
+					++m;
+				}
+				pre_context.clear();
+			} else if (c1 == to_context) {
+				// turn change line into context line
+				auto& dest = c1 == '-' ? pre_context : patch;
+				dest += ' ';
+				dest.append(l, 1, std::string::npos);
+				dest += '\n';
+				++n;
+				++m;
+			} else {
+				// a change in the opposite direction of
+				// to_context which is outside the range of
+				// lines to apply.
+				patch += pre_context;
+				pre_context.clear();
+			}
+		}
+		patch += pre_context;
+		auto hln = std::to_string(h->old_start);
+		wholepatch += "@@ -"s + hln + "," + std::to_string(n)
+			+ " +" + hln + "," + std::to_string(m) + " @@\n" + patch;
+		first = i + 1;
+	}
+	return wholepatch;
+}
+
+// Whether text occurs in the hunk with header line header. The text can
+// span several lines.
+bool DiffModel::hunk_contains(int header, const std::string& text, bool nocase) const
+{
+	std::string body;
+	for (int i = header + 1, e = hunk_end(header); i < e; i++)
+	{
+		body += lines[i];
+		body += '\n';
+	}
+	auto eq = [nocase](char a, char b) {
+		return nocase ? std::tolower((unsigned char)a) == std::tolower((unsigned char)b) : a == b;
+	};
+	return std::search(body.begin(), body.end(), text.begin(), text.end(), eq) != body.end();
+}
+
+// Computes the word differences of each block of "-" lines that is followed
+// by a block of "+" lines in the hunk with header line header. The changed
+// ranges are appended to old_idx and new_idx as pairs of text widget
+// indices.
+void DiffModel::hunk_word_diff(int header, std::string& old_idx, std::string& new_idx) const
+{
+	auto append = [](std::string& idx, int base, const std::vector<WordChange>& changes) {
+		for (const auto& c: changes)
+		{
+			// widget lines start at 1, and the text at column 1
+			auto l = std::to_string(base + c.line + 1) + ".";
+			idx += l + std::to_string(c.begin + 1) + " ";
+			idx += l + std::to_string(c.end + 1) + " ";
+		}
+	};
+
+	int e = hunk_end(header);
+	for (int i = header + 1; i < e; ) {
+		if (lines[i].compare(0, 1, "-") != 0) {
+			i++;
+			continue;
+		}
+		int old_first = i;
+		std::vector<std::string> old_lines, new_lines;
+		for (; i < e && lines[i].compare(0, 1, "-") == 0; i++)
+			old_lines.push_back(lines[i].substr(1));
+		int new_first = i;
+		for (; i < e && lines[i].compare(0, 1, "+") == 0; i++)
+			new_lines.push_back(lines[i].substr(1));
+		if (new_lines.empty())
+			continue;
+
+		std::vector<WordChange> old_changes, new_changes;
+		word_diff(old_lines, new_lines, old_changes, new_changes);
+		append(old_idx, old_first, old_changes);
+		append(new_idx, new_first, new_changes);
+	}
+}
+
+DiffModel model;
+
+// The widget line number of a Tcl argument as a model index.
+bool get_line(Tcl_Interp* interp, Tcl_Obj* obj, int& i)
+{
+	if (!tcl_int(interp, obj, i))
+		return false;
+	--i;
+	return true;
+}
+
+int cmd_clear(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 1) {
+		Tcl_WrongNumArgs(interp, 1, objv, "");
+		return TCL_ERROR;
+	}
+	model.clear();
+	return TCL_OK;
+}
+
+// diff_model::append lno lines
+int cmd_append(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int at;
+	int n;
+	Tcl_Obj** elems;
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "lno lines");
+		return TCL_ERROR;
+	}
+	if (!get_line(interp, objv[1], at) || at < 0
+	    || Tcl_ListObjGetElements(interp, objv[2], &n, &elems) != TCL_OK)
+		return TCL_ERROR;
+
+	std::vector<std::string> new_lines;
+	new_lines.reserve(n);
+	for (int k = 0; k < n; k++)
+		new_lines.push_back(tcl_string(elems[k]));
+	model.append(at, new_lines);
+	return TCL_OK;
+}
+
+// diff_model::delete first last
+// Removes the lines first up to, but excluding, last.
+int cmd_delete(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int first, last;
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "first last");
+		return TCL_ERROR;
+	}
+	if (!get_line(interp, objv[1], first) || !get_line(interp, objv[2], last))
+		return TCL_ERROR;
+	model.erase(first, last);
+	return TCL_OK;
+}
+
+// diff_model::hunk lno
+// Returns the first line and the line after the end of the hunk whose
+// header is the last one above lno, or an empty list if there is none.
+int cmd_hunk(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int i;
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "lno");
+		return TCL_ERROR;
+	}
+	if (!get_line(interp, objv[1], i))
+		return TCL_ERROR;
+
+	auto h = model.hunk_before(i);
+	if (h != model.hunks.end()) {
+		Tcl_Obj* r[2] = {
+			Tcl_NewIntObj(h->line + 1),
+			Tcl_NewIntObj(model.hunk_end(h->line) + 1),
+		};
+		Tcl_SetObjResult(interp, Tcl_NewListObj(2, r));
+	}
+	return TCL_OK;
+}
+
+// diff_model::get first last
+// Returns the text of the lines first up to, but excluding, last.
+int cmd_get(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int first, last;
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "first last");
+		return TCL_ERROR;
+	}
+	if (!get_line(interp, objv[1], first) || !get_line(interp, objv[2], last))
+		return TCL_ERROR;
+
+	first = std::max(first, 0);
+	last = std::min(last, int(model.lines.size()));
+	std::string text;
+	for (int i = first; i < last; i++)
+	{
+		text += model.lines[i];
+		text += '\n';
+	}
+	Tcl_SetObjResult(interp, tcl_obj(text));
+	return TCL_OK;
+}
+
+// diff_model::range_patch first last to_context
+// Returns the patch for the changed lines from line first to line last
+// (inclusive), or an empty string if there is no hunk in the range.
+int cmd_range_patch(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int first, last;
+	if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "first last to_context");
+		return TCL_ERROR;
+	}
+	if (!get_line(interp, objv[1], first) || !get_line(interp, objv[2], last))
+		return TCL_ERROR;
+	auto to_context = tcl_string(objv[3]);
+	if (to_context != "-" && to_context != "+") {
+		Tcl_SetObjResult(interp, tcl_obj("to_context must be - or +"));
+		return TCL_ERROR;
+	}
+
+	Tcl_SetObjResult(interp, tcl_obj(model.range_patch(first, last, to_context[0])));
+	return TCL_OK;
+}
+
+// diff_model::hunk_ranges headers
+// Returns the first line and the line after the end of each hunk whose
+// header line is listed in headers, as a flat list ordered by line.
+int cmd_hunk_ranges(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int n;
+	Tcl_Obj** elems;
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "headers");
+		return TCL_ERROR;
+	}
+	if (Tcl_ListObjGetElements(interp, objv[1], &n, &elems) != TCL_OK)
+		return TCL_ERROR;
+
+	std::vector<int> headers;
+	for (int k = 0; k < n; k++)
+	{
+		int i;
+		if (!get_line(interp, elems[k], i))
+			return TCL_ERROR;
+		if (i >= 0 && i < int(model.lines.size()) && model.is_header(i))
+			headers.push_back(i);
+	}
+	std::sort(headers.begin(), headers.end());
+	headers.erase(std::unique(headers.begin(), headers.end()), headers.end());
+
+	Tcl_Obj* result = Tcl_NewListObj(0, nullptr);
+	for (auto i: headers)
+	{
+		Tcl_ListObjAppendElement(interp, result, Tcl_NewIntObj(i + 1));
+		Tcl_ListObjAppendElement(interp, result, Tcl_NewIntObj(model.hunk_end(i) + 1));
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// diff_model::find_hunks ?-nocase? text
+// Returns the header lines of all hunks that contain text.
+int cmd_find_hunks(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	bool nocase = objc == 3 && tcl_string(objv[1]) == "-nocase";
+	if (objc != 2 && !nocase) {
+		Tcl_WrongNumArgs(interp, 1, objv, "?-nocase? text");
+		return TCL_ERROR;
+	}
+	auto text = tcl_string(objv[objc - 1]);
+
+	Tcl_Obj* result = Tcl_NewListObj(0, nullptr);
+	if (!text.empty()) {
+		for (const auto& h: model.hunks)
+		{
+			if (model.hunk_contains(h.line, text, nocase))
+				Tcl_ListObjAppendElement(interp, result, Tcl_NewIntObj(h.line + 1));
+		}
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// diff_model::word_diff first last
+// Computes the word differences of the hunks that overlap the lines first
+// to last and that were not handled by an earlier call. Returns a list of
+// two lists of text widget indices, which delimit the changed ranges of
+// the removed and the added lines, respectively.
+int cmd_word_diff(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int first, last;
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "first last");
+		return TCL_ERROR;
+	}
+	if (!get_line(interp, objv[1], first) || !get_line(interp, objv[2], last))
+		return TCL_ERROR;
+
+	std::string old_idx, new_idx;
+	auto h = std::upper_bound(model.hunks.begin(), model.hunks.end(), first,
+			[](int i, const Hunk& h) { return i < h.line; });
+	if (h != model.hunks.begin())
+		--h;
+	for (; h != model.hunks.end() && h->line <= last; ++h)
+	{
+		if (h->words_done)
+			continue;
+		h->words_done = true;
+		model.hunk_word_diff(h->line, old_idx, new_idx);
+	}
+
+	// drop the trailing blanks
+	for (auto idx: { &old_idx, &new_idx })
+		if (!idx->empty())
+			idx->pop_back();
+	Tcl_Obj* r[2] = { tcl_obj(old_idx), tcl_obj(new_idx) };
+	Tcl_SetObjResult(interp, Tcl_NewListObj(2, r));
+	return TCL_OK;
+}
+
+} // namespace
+
+void diff_model_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "diff_model::clear", cmd_clear, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::append", cmd_append, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::delete", cmd_delete, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::hunk", cmd_hunk, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::get", cmd_get, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::range_patch", cmd_range_patch, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::hunk_ranges", cmd_hunk_ranges, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::find_hunks", cmd_find_hunks, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "diff_model::word_diff", cmd_word_diff, nullptr, nullptr);
+}
@@ -0,0 +1,7 @@
+// git-guing: in-memory model of the displayed diff
+
+#pragma once
+
+#include <tcl.h>
+
+void diff_model_init(Tcl_Interp* interp);
@@ -10,10 +10,13 @@ proc _delete_indexlock {} {
 	}
 }
 
-proc _close_updateindex {fd after} {
+proc _close_updateindex {fd after {changes {}} {output {}}} {
 	global use_ttk NS
 	fconfigure $fd -blocking 1
 	if {[catch {close $fd} err]} {
+		if {$output ne {}} {
+			append err \n\n $output
+		}
 		set w .indexfried
 		Dialog $w
 		wm withdraw $w
@@ -54,55 +57,40 @@ proc _close_updateindex {fd after} {
 		return
 	}
 
+	foreach {path new} $changes {
+		display_file $path $new
+	}
+
 	$::main_status stop
 	unlock_index
 	uplevel #0 $after
 }
 
-proc update_indexinfo {msg pathList after} {
-	global update_index_cp
-
-	if {![lock_index update]} return
-
-	set update_index_cp 0
-	set pathList [lsort $pathList]
-	set totalCnt [llength $pathList]
-	set batch [expr {int($totalCnt * .01) + 1}]
-	if {$batch > 25} {set batch 25}
-
+# Streams the records to git in the background, and applies the state
+# changes, a list of path and new state pairs, once git has finished.
+#
+proc _start_updateindex {msg cmd records changes after} {
 	$::main_status start $msg [mc "files"]
-	set fd [git_write update-index -z --index-info]
+	set fd [eval git_write $cmd]
 	fconfigure $fd \
 		-blocking 0 \
 		-buffering full \
-		-buffersize 512 \
+		-buffersize 1048576 \
 		-encoding binary \
 		-translation binary
-	fileevent $fd writable [list \
-		write_update_indexinfo \
-		$fd \
-		$pathList \
-		$totalCnt \
-		$batch \
-		$after \
-		]
+	write_records $fd $records \
+		[list $::main_status update] \
+		[list _close_updateindex $fd $after $changes]
 }
 
-proc write_update_indexinfo {fd pathList totalCnt batch after} {
-	global update_index_cp
-	global file_states current_diff_path
-
-	if {$update_index_cp >= $totalCnt} {
-		_close_updateindex $fd $after
-		return
-	}
+proc update_indexinfo {msg pathList after} {
+	global file_states
 
-	for {set i $batch} \
-		{$update_index_cp < $totalCnt && $i > 0} \
-		{incr i -1} {
-		set path [lindex $pathList $update_index_cp]
-		incr update_index_cp
+	if {![lock_index update]} return
 
+	set records [list]
+	set changes [list]
+	foreach path [lsort $pathList] {
 		set s $file_states($path)
 		switch -glob -- [lindex $s 0] {
 		A? {set new _O}
@@ -118,57 +106,23 @@ proc write_update_indexinfo {fd pathList totalCnt batch after} {
 		set info [lindex $s 2]
 		if {$info eq {}} continue
 
-		puts -nonewline $fd "$info\t[encoding convertto utf-8 $path]\0"
-		display_file $path $new
+		lappend records "$info\t$path"
+		lappend changes $path $new
 	}
 
-	$::main_status update $update_index_cp $totalCnt
+	_start_updateindex $msg \
+		[list update-index -z --index-info] \
+		$records $changes $after
 }
 
 proc update_index {msg pathList after} {
-	global update_index_cp
+	global file_states
 
 	if {![lock_index update]} return
 
-	set update_index_cp 0
-	set pathList [lsort $pathList]
-	set totalCnt [llength $pathList]
-	set batch [expr {int($totalCnt * .01) + 1}]
-	if {$batch > 25} {set batch 25}
-
-	$::main_status start $msg [mc "files"]
-	set fd [git_write update-index --add --remove -z --stdin]
-	fconfigure $fd \
-		-blocking 0 \
-		-buffering full \
-		-buffersize 512 \
-		-encoding binary \
-		-translation binary
-	fileevent $fd writable [list \
-		write_update_index \
-		$fd \
-		$pathList \
-		$totalCnt \
-		$batch \
-		$after \
-		]
-}
-
-proc write_update_index {fd pathList totalCnt batch after} {
-	global update_index_cp
-	global file_states current_diff_path
-
-	if {$update_index_cp >= $totalCnt} {
-		_close_updateindex $fd $after
-		return
-	}
-
-	for {set i $batch} \
-		{$update_index_cp < $totalCnt && $i > 0} \
-		{incr i -1} {
-		set path [lindex $pathList $update_index_cp]
-		incr update_index_cp
-
+	set records [list]
+	set changes [list]
+	foreach path [lsort $pathList] {
 		switch -glob -- [lindex $file_states($path) 0] {
 		AD {set new __}
 		?D {set new D_}
@@ -189,74 +143,112 @@ proc write_update_index {fd pathList totalCnt batch after} {
 		?M {set new M_}
 		?? {continue}
 		}
-		puts -nonewline $fd "[encoding convertto utf-8 $path]\0"
-		display_file $path $new
+
+		lappend records $path
+		lappend changes $path $new
 	}
 
-	$::main_status update $update_index_cp $totalCnt
+	_start_updateindex $msg \
+		[list update-index --add --remove -z --stdin] \
+		$records $changes $after
 }
 
-proc checkout_index {msg pathList after} {
-	global update_index_cp
+# Reverts the paths with a single git restore, which lets git check the
+# files out with parallel workers. git reports the progress itself.
+#
+proc _start_bulk_checkout {msg paths changes after} {
+	$::main_status start $msg [mc "files"]
 
-	if {![lock_index update]} return
+	if {[catch {
+		set fd [git_read --input --stderr \
+			-c checkout.workers=0 \
+			--literal-pathspecs \
+			restore \
+			--worktree \
+			--progress \
+			--pathspec-from-file=- \
+			--pathspec-file-nul \
+			]
+	} err]} {
+		$::main_status stop
+		unlock_index
+		error_popup $err
+		return
+	}
 
-	set update_index_cp 0
-	set pathList [lsort $pathList]
-	set totalCnt [llength $pathList]
-	set batch [expr {int($totalCnt * .01) + 1}]
-	if {$batch > 25} {set batch 25}
+	# git may exit before it has read all paths, e.g. on a bad one.
+	#
+	if {[catch {
+		fconfigure $fd -translation binary -encoding binary
+		puts -nonewline $fd [encoding convertto utf-8 [join $paths "\0"]]
+		puts -nonewline $fd "\0"
+		close $fd write
+	} err]} {
+		catch {close $fd}
+		$::main_status stop
+		unlock_index
+		error_popup $err
+		return
+	}
 
-	$::main_status start $msg [mc "files"]
-	set fd [git_write checkout-index \
-		--index \
-		--quiet \
-		--force \
-		-z \
-		--stdin \
-		]
-	fconfigure $fd \
-		-blocking 0 \
-		-buffering full \
-		-buffersize 512 \
-		-encoding binary \
-		-translation binary
-	fileevent $fd writable [list \
-		write_checkout_index \
-		$fd \
-		$pathList \
-		$totalCnt \
-		$batch \
-		$after \
-		]
+	fconfigure $fd -blocking 0
+	fileevent $fd readable [list _read_bulk_checkout $fd $changes $after]
 }
 
-proc write_checkout_index {fd pathList totalCnt batch after} {
-	global update_index_cp
-	global file_states current_diff_path
-
-	if {$update_index_cp >= $totalCnt} {
-		_close_updateindex $fd $after
+# Feeds the progress to the status bar, and keeps all other lines git
+# writes, e.g. errors, to show them if git fails. line is the unfinished
+# last line read so far.
+#
+proc _read_bulk_checkout {fd changes after {line {}} {output {}}} {
+	set buf [read $fd]
+	$::main_status update_meter $buf
+	set lines [split $line$buf \n]
+	if {![eof $fd]} {
+		set line [lindex $lines end]
+		set line [string range $line [expr {[string last \r $line] + 1}] end]
+		set lines [lrange $lines 0 end-1]
+	}
+	foreach l $lines {
+		set l [string range $l [expr {[string last \r $l] + 1}] end]
+		if {$l ne {} && ![regexp {:\s*\d+% \(\d+/\d+\)} $l]} {
+			lappend output $l
+		}
+	}
+	if {[eof $fd]} {
+		_close_updateindex $fd $after $changes \
+			[encoding convertfrom utf-8 [join $output \n]]
 		return
 	}
+	fileevent $fd readable \
+		[list _read_bulk_checkout $fd $changes $after $line $output]
+}
+
+proc checkout_index {msg pathList after} {
+	global file_states
 
-	for {set i $batch} \
-		{$update_index_cp < $totalCnt && $i > 0} \
-		{incr i -1} {
-		set path [lindex $pathList $update_index_cp]
-		incr update_index_cp
+	if {![lock_index update]} return
+
+	set records [list]
+	set changes [list]
+	foreach path [lsort $pathList] {
 		switch -glob -- [lindex $file_states($path) 0] {
 		U? {continue}
 		?M -
 		?T -
 		?D {
-			puts -nonewline $fd "[encoding convertto utf-8 $path]\0"
-			display_file $path ?_
+			lappend records $path
+			lappend changes $path ?_
 		}
 		}
 	}
 
-	$::main_status update $update_index_cp $totalCnt
+	if {[git-version >= 2.32]} {
+		_start_bulk_checkout $msg $records $changes $after
+	} else {
+		_start_updateindex $msg \
+			[list checkout-index --index --quiet --force -z --stdin] \
+			$records $changes $after
+	}
 }
 
 proc unstage_helper {txt paths} {
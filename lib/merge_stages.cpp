@@ -0,0 +1,103 @@
+// git-guing: the unmerged index entries of a conflicted merge
+
+#include "merge_stages.h"
+#include "native.h"
+#include <array>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+// An index entry of one stage: mode and object name. Both are empty if
+// the path has no entry in the stage.
+struct Stage
+{
+	std::string mode;
+	std::string sha1;
+};
+
+// Stages 0 to 3 of every unmerged path, as loaded by the last rescan.
+std::unordered_map<std::string, std::array<Stage, 4>> stages;
+
+// merge_stages::clear
+// Forgets all unmerged entries.
+int cmd_clear(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 1) {
+		Tcl_WrongNumArgs(interp, 1, objv, "");
+		return TCL_ERROR;
+	}
+	stages.clear();
+	return TCL_OK;
+}
+
+// merge_stages::add records
+// Adds the records of git ls-files -u -z, "mode sha1 stage<TAB>path".
+int cmd_add(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	Tcl_Obj** recs;
+	int n;
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "records");
+		return TCL_ERROR;
+	}
+	if (Tcl_ListObjGetElements(interp, objv[1], &n, &recs) != TCL_OK)
+		return TCL_ERROR;
+
+	for (int i = 0; i < n; i++)
+	{
+		auto rec = tcl_string(recs[i]);
+		auto tab = rec.find('\t');
+		auto sp1 = rec.find(' ');
+		auto sp2 = rec.find(' ', sp1 + 1);
+		if (tab == std::string::npos || sp2 == std::string::npos || sp2 + 2 != tab)
+			continue;
+		int stage = rec[sp2 + 1] - '0';
+		if (stage < 0 || stage > 3)
+			continue;
+		auto& s = stages[rec.substr(tab + 1)][stage];
+		s.mode = rec.substr(0, sp1);
+		s.sha1 = rec.substr(sp1 + 1, sp2 - sp1 - 1);
+	}
+	return TCL_OK;
+}
+
+// merge_stages::get path
+// Returns the stages of the path in a form suitable for array set: the
+// stage numbers 0 to 3, each followed by the list of mode and object name,
+// or by an empty list if the path has no entry in that stage. Returns an
+// empty list if the path is not known to be unmerged.
+int cmd_get(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "path");
+		return TCL_ERROR;
+	}
+	auto it = stages.find(tcl_string(objv[1]));
+	if (it == stages.end())
+		return TCL_OK;
+
+	auto result = Tcl_NewListObj(0, nullptr);
+	for (int i = 0; i < 4; i++)
+	{
+		auto& s = it->second[i];
+		Tcl_ListObjAppendElement(nullptr, result, Tcl_NewIntObj(i));
+		auto entry = Tcl_NewListObj(0, nullptr);
+		if (!s.mode.empty()) {
+			Tcl_ListObjAppendElement(nullptr, entry, tcl_obj(s.mode));
+			Tcl_ListObjAppendElement(nullptr, entry, tcl_obj(s.sha1));
+		}
+		Tcl_ListObjAppendElement(nullptr, result, entry);
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+} // namespace
+
+void merge_stages_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "merge_stages::clear", cmd_clear, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "merge_stages::add", cmd_add, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "merge_stages::get", cmd_get, nullptr, nullptr);
+}
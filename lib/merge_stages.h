@@ -0,0 +1,7 @@
+// git-guing: the unmerged index entries of a conflicted merge
+
+#pragma once
+
+#include <tcl.h>
+
+void merge_stages_init(Tcl_Interp* interp);
@@ -77,12 +77,186 @@ proc merge_force_stage {stage} {
 	merge_add_resolution $current_diff_path
 }
 
+# Resolves all given paths that are unmerged to the version of stage 2
+# (this branch) or 3 (the other branch). The chosen versions are checked
+# out by one git checkout-index, and all resolutions are added to the
+# index by one git update-index.
+#
+proc merge_resolve_many {stage paths} {
+	global file_states current_diff_path ui_workdir
+
+	set unmerged [list]
+	foreach path [lsort $paths] {
+		if {[info exists file_states($path)]
+			&& [string first U [lindex $file_states($path) 0]] >= 0} {
+			lappend unmerged $path
+		}
+	}
+	set n [llength $unmerged]
+	if {$n == 0} {
+		info_popup [mc "There are no unmerged files to resolve."]
+		return
+	}
+
+	set checkout [list]
+	set remove [list]
+	foreach path $unmerged {
+		set known [merge_stages::get $path]
+		if {$known ne {} && [lindex $known [expr {2 * $stage + 1}]] eq {}} {
+			# Not present in the chosen version.
+			lappend remove $path
+		} else {
+			lappend checkout $path
+		}
+	}
+
+	switch -- $stage {
+		2 { set targetquestion [mc "Force resolution of %d files to this branch?" $n] }
+		3 { set targetquestion [mc "Force resolution of %d files to the other branch?" $n] }
+	}
+	set op_question [strcat $targetquestion "\n\n" \
+		[mc "The files will be overwritten with the chosen version."]]
+	if {$remove ne {}} {
+		append op_question "\n" [mc "%d of them do not exist in it and will be deleted." \
+			[llength $remove]]
+	}
+	append op_question "\n\n" \
+		[mc "This operation can be undone only by restarting the merge."]
+	if {[ask_popup $op_question] ne {yes}} return
+
+	if {![lock_index begin-update]} return
+
+	foreach path $remove {
+		catch {file delete -- $path}
+	}
+
+	set after {}
+	if {[lsearch -sorted -exact $unmerged $current_diff_path] >= 0} {
+		set after [next_diff_after_action $ui_workdir $current_diff_path {} {^_?U}]
+	}
+	set cont [list _merge_resolve_add $unmerged [concat $after [list ui_ready]]]
+
+	if {$checkout eq {}} {
+		eval $cont
+		return
+	}
+
+	$::main_status start [mc "Checking out chosen versions"] [mc "files"]
+	set fd [git_write checkout-index -f -z --stdin --stage=$stage]
+	fconfigure $fd \
+		-blocking 0 \
+		-buffering full \
+		-buffersize 1048576 \
+		-encoding binary \
+		-translation binary
+	write_records $fd $checkout \
+		[list $::main_status update] \
+		[list _merge_resolve_checked_out $fd $cont]
+}
+
+proc _merge_resolve_checked_out {fd cont} {
+	fconfigure $fd -blocking 1
+	set failed [catch {close $fd} err]
+	$::main_status stop
+	if {$failed} {
+		unlock_index
+		error_popup [strcat [mc "Unable to check out the chosen versions:"] "\n\n$err"]
+		rescan ui_ready
+		return
+	}
+	eval $cont
+}
+
+proc _merge_resolve_add {paths after} {
+	update_index \
+		[mc "Adding resolutions for %d files" [llength $paths]] \
+		$paths \
+		$after
+}
+
+proc merge_resolve_selection {stage} {
+	global current_diff_path selected_paths
+
+	if {[array size selected_paths] > 0} {
+		merge_resolve_many $stage [array names selected_paths]
+	} elseif {$current_diff_path ne {}} {
+		merge_resolve_many $stage [list $current_diff_path]
+	}
+}
+
+proc merge_resolve_matching {stage} {
+	global use_ttk NS file_states merge_resolve_glob merge_resolve_go
+
+	set w .resolve_matching
+	Dialog $w
+	wm withdraw $w
+	wm title $w [mc "%s (%s): Resolve Matching Files" [appname] [reponame]]
+	wm geometry $w "+[winfo rootx .]+[winfo rooty .]"
+
+	switch -- $stage {
+		2 { set header [mc "Use Local Version For Files Matching"] }
+		3 { set header [mc "Use Remote Version For Files Matching"] }
+	}
+	${NS}::label $w.header -text $header -font font_uibold -anchor center
+	pack $w.header -side top -fill x
+
+	set merge_resolve_go 0
+	${NS}::frame $w.buttons
+	${NS}::button $w.buttons.resolve -text [mc Resolve] \
+		-default active \
+		-command "set merge_resolve_go 1; destroy $w"
+	pack $w.buttons.resolve -side right
+	${NS}::button $w.buttons.cancel -text [mc Cancel] \
+		-command [list destroy $w]
+	pack $w.buttons.cancel -side right -padx 5
+	pack $w.buttons -side bottom -fill x -pady 10 -padx 10
+
+	${NS}::frame $w.glob
+	${NS}::label $w.glob.l -text [mc "Pattern:"]
+	${NS}::entry $w.glob.t -width 40 -textvariable merge_resolve_glob
+	grid $w.glob.l $w.glob.t -sticky we -padx {0 5}
+	grid columnconfigure $w.glob 1 -weight 1
+	pack $w.glob -anchor nw -fill x -pady 5 -padx 5
+
+	bind $w <Key-Return> "set merge_resolve_go 1; destroy $w"
+	bind $w <Key-Escape> [list destroy $w]
+	bind $w <Visibility> "
+		grab $w
+		$w.glob.t icursor end
+		focus $w.glob.t
+	"
+	wm deiconify $w
+	tkwait window $w
+
+	if {!$merge_resolve_go || $merge_resolve_glob eq {}} return
+
+	set paths [list]
+	foreach path [array names file_states] {
+		if {[string match $merge_resolve_glob $path]} {
+			lappend paths $path
+		}
+	}
+	merge_resolve_many $stage $paths
+}
+
+# Loads the stages of the unmerged path into merge_stages and continues
+# with cont. The stages of all unmerged paths are read by each rescan;
+# only paths that are not known from there are asked from git.
+#
 proc merge_load_stages {path cont} {
 	global merge_stages_fd merge_stages merge_stages_buf
 
 	if {[info exists merge_stages_fd]} {
 		catch { kill_file_process $merge_stages_fd }
 		catch { close $merge_stages_fd }
+		unset merge_stages_fd
+	}
+
+	set known [merge_stages::get $path]
+	if {$known ne {}} {
+		array set merge_stages $known
+		eval $cont
+		return
 	}
 
 	set merge_stages(0) {}
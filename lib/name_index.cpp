@@ -0,0 +1,169 @@
+// git-guing: ranked filtering of long lists of names
+//
+// The revision chooser filters its list of branches or tags while the user
+// types. The names are kept here under a key, lowercased next to their
+// char_mask(), and matched with the same fuzzy matcher as "Go to file":
+// the characters of the query must appear in the name in order. Matches
+// are ranked by where the query is found, best first:
+// - at the start of the name,
+// - at the start of a word, i.e. after a slash, dash, underscore or dot,
+// - anywhere else in the name,
+// - scattered across the name.
+// Names keep their order within each group. As with paths, the matches of
+// the last query are narrowed down while the user types.
+
+#include "name_index.h"
+#include "native.h"
+#include "path_index.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Index
+{
+	std::string lower;		// NUL terminated names
+	std::vector<uint32_t> start;	// of each name in lower
+	std::vector<uint64_t> chars;	// char_mask() of each name
+
+	std::string last_query;
+	std::vector<uint32_t> last_matches;	// of last_query, in order
+};
+
+std::unordered_map<std::string, Index> indexes;
+
+bool is_word_start(const char* name, const char* p)
+{
+	return p == name || std::strchr("/-_.", p[-1]);
+}
+
+uint32_t group_of(const char* name, const std::string& q)
+{
+	const char* p = std::strstr(name, q.c_str());
+	if (!p)
+		return 0;
+	if (p == name)
+		return 3;
+	for (; p; p = std::strstr(p + 1, q.c_str()))
+		if (is_word_start(name, p))
+			return 2;
+	return 1;
+}
+
+// name_index::set key names
+// Replaces the names kept under the key.
+int cmd_set(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "key names");
+		return TCL_ERROR;
+	}
+	Tcl_Obj** names;
+	int n;
+	if (Tcl_ListObjGetElements(interp, objv[2], &n, &names) != TCL_OK)
+		return TCL_ERROR;
+
+	auto& x = indexes[tcl_string(objv[1])];
+	x = Index();
+	for (int i = 0; i < n; i++)
+	{
+		int len;
+		const char* s = Tcl_GetStringFromObj(names[i], &len);
+		x.start.push_back(x.lower.size());
+		for (int k = 0; k < len; k++)
+			x.lower += std::tolower(static_cast<unsigned char>(s[k]));
+		x.lower += '\0';
+		x.chars.push_back(char_mask(x.lower.data() + x.start.back(), len));
+	}
+	return TCL_OK;
+}
+
+// name_index::drop key
+// Forgets the names kept under the key.
+int cmd_drop(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "key");
+		return TCL_ERROR;
+	}
+	indexes.erase(tcl_string(objv[1]));
+	return TCL_OK;
+}
+
+// name_index::match key query limit
+// Returns the positions of the best limit names that match the query,
+// best first, followed by the total number of matches. An empty query
+// matches all names in their order. Case is ignored.
+int cmd_match(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int limit;
+	if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "key query limit");
+		return TCL_ERROR;
+	}
+	if (!tcl_int(interp, objv[3], limit))
+		return TCL_ERROR;
+	auto result = Tcl_NewListObj(0, nullptr);
+	auto it = indexes.find(tcl_string(objv[1]));
+	if (it == indexes.end()) {
+		Tcl_ListObjAppendElement(nullptr, result, Tcl_NewIntObj(0));
+		Tcl_SetObjResult(interp, result);
+		return TCL_OK;
+	}
+	auto& x = it->second;
+	std::string q;
+	for (char c : tcl_string(objv[2]))
+		q += std::tolower(static_cast<unsigned char>(c));
+
+	// Names are taken group by group, each in order, until limit are
+	// found, so only the counts of the groups are needed beyond that.
+	size_t keep = std::max(limit, 0);
+	std::vector<uint32_t> matches;
+	std::vector<uint32_t> best[4];
+	uint64_t need = char_mask(q.data(), q.size());
+	auto consider = [&](uint32_t i) {
+		const char* name = x.lower.data() + x.start[i];
+		if ((x.chars[i] & need) != need || !is_subsequence(name, q))
+			return;
+		matches.push_back(i);
+		if (best[3].size() >= keep)
+			return;
+		auto& g = best[group_of(name, q)];
+		if (g.size() < keep)
+			g.push_back(i);
+	};
+
+	if (!x.last_query.empty() && q.compare(0, x.last_query.size(), x.last_query) == 0) {
+		for (auto i : x.last_matches)
+			consider(i);
+	} else {
+		for (uint32_t i = 0; i < x.start.size(); i++)
+			consider(i);
+	}
+	x.last_query = q;
+	x.last_matches.swap(matches);
+
+	size_t shown = 0;
+	for (int g = 3; g >= 0; g--)
+	{
+		for (size_t k = 0; k < best[g].size() && shown < keep; k++, shown++)
+			Tcl_ListObjAppendElement(nullptr, result, Tcl_NewIntObj(best[g][k]));
+	}
+	Tcl_ListObjAppendElement(nullptr, result, Tcl_NewIntObj(x.last_matches.size()));
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+} // namespace
+
+void name_index_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "name_index::drop", cmd_drop, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "name_index::match", cmd_match, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "name_index::set", cmd_set, nullptr, nullptr);
+}
@@ -0,0 +1,7 @@
+// git-guing: ranked filtering of long lists of names
+
+#pragma once
+
+#include <tcl.h>
+
+void name_index_init(Tcl_Interp* interp);
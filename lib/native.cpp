@@ -0,0 +1,55 @@
+// git-guing: native helper commands for the Tcl code
+
+#include "native.h"
+#include "blame_data.h"
+#include "commit_store.h"
+#include "diff_model.h"
+#include "merge_stages.h"
+#include "name_index.h"
+#include "path_index.h"
+#include "record_writer.h"
+#include "ref_store.h"
+#include "text_input.h"
+#include "tree_store.h"
+
+std::string tcl_string(Tcl_Obj* obj)
+{
+	int len;
+	const char* s = Tcl_GetStringFromObj(obj, &len);
+	return std::string(s, len);
+}
+
+Tcl_Obj* tcl_obj(const std::string& s)
+{
+	return Tcl_NewStringObj(s.data(), s.size());
+}
+
+bool tcl_int(Tcl_Interp* interp, Tcl_Obj* obj, int& value)
+{
+	return Tcl_GetIntFromObj(interp, obj, &value) == TCL_OK;
+}
+
+bool is_hex_id(const std::string& s)
+{
+	if (s.size() != 40 && s.size() != 64)
+		return false;
+	for (char c : s)
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+			return false;
+	return true;
+}
+
+int Gitgui_Init(Tcl_Interp* interp)
+{
+	blame_data_init(interp);
+	commit_store_init(interp);
+	diff_model_init(interp);
+	merge_stages_init(interp);
+	name_index_init(interp);
+	path_index_init(interp);
+	record_writer_init(interp);
+	ref_store_init(interp);
+	text_input_init(interp);
+	tree_store_init(interp);
+	return Tcl_PkgProvide(interp, "Gitgui", "1.0");
+}
@@ -0,0 +1,18 @@
+// git-guing: native helper commands for the Tcl code
+
+#pragma once
+
+#include <tcl.h>
+#include <string>
+
+// Registers the commands of all native modules. It is handed to
+// Tcl_StaticPackage and runs when the package is loaded.
+int Gitgui_Init(Tcl_Interp* interp);
+
+// Helpers shared by the command implementations.
+std::string tcl_string(Tcl_Obj* obj);
+Tcl_Obj* tcl_obj(const std::string& s);
+bool tcl_int(Tcl_Interp* interp, Tcl_Obj* obj, int& value);
+
+// Whether s is a full object id, SHA-1 or SHA-256, in lowercase hex.
+bool is_hex_id(const std::string& s);
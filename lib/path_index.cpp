@@ -0,0 +1,309 @@
+// git-guing: index of all paths in a tree for "Go to file"
+//
+// The index is filled from the output of git ls-tree -r -t -z and kept by
+// the id of the tree, since trees never change. Paths are stored in one
+// string, next to a lowercase copy for matching, and are looked up with
+// a fuzzy matcher: the characters of the query must appear in the path in
+// order. Matches are ranked by where the query is found, best first:
+// - at the start of the last path component,
+// - within the last path component,
+// - within the path,
+// - scattered across the path.
+// Shorter paths rank higher within each group. Since the matches of a
+// query are among the matches of its prefix, the candidates of the last
+// query are remembered and narrowed down while the user types.
+
+#include "path_index.h"
+#include "native.h"
+#include "text_input.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t max_indexes = 4;
+
+struct Index
+{
+	std::string tree;
+	bool complete = false;
+	std::string paths;		// NUL terminated
+	std::string lower;		// lowercase copy of paths
+	std::vector<uint32_t> start;	// of each path in paths
+	std::vector<uint32_t> base;	// of the last component of each path
+	std::vector<uint64_t> chars;	// char_mask() of each path
+	std::string types;		// t, c or b for tree, commit or blob
+
+	std::string last_query;
+	std::vector<uint32_t> last_matches;	// of last_query, unranked
+	size_t last_size = 0;		// paths when last_matches was made
+
+	const char* path(uint32_t i) const { return paths.data() + start[i]; }
+	const char* low(uint32_t i) const { return lower.data() + start[i]; }
+	size_t length(uint32_t i) const
+	{
+		size_t end = i + 1 < start.size() ? start[i + 1] : paths.size();
+		return end - start[i] - 1;
+	}
+};
+
+std::list<Index> indexes;	// most recently used first
+
+Index* find(const std::string& tree)
+{
+	for (auto it = indexes.begin(); it != indexes.end(); ++it)
+	{
+		if (it->tree == tree) {
+			indexes.splice(indexes.begin(), indexes, it);
+			return &indexes.front();
+		}
+	}
+	return nullptr;
+}
+
+std::string lowercase(std::string s)
+{
+	for (auto& c : s)
+		c = std::tolower(static_cast<unsigned char>(c));
+	return s;
+}
+
+uint32_t score_of(uint32_t group, size_t len)
+{
+	return (group << 24) | uint32_t(0xffffff - std::min<size_t>(len, 0xffffff));
+}
+
+uint32_t score(const Index& x, uint32_t i, const std::string& q)
+{
+	const char* p = x.low(i);
+	size_t len = x.length(i);
+	const char* base = x.lower.data() + x.base[i];
+
+	uint32_t group;
+	if (std::strncmp(base, q.c_str(), q.size()) == 0)
+		group = 3;
+	else if (std::strstr(base, q.c_str()))
+		group = 2;
+	else if (std::strstr(p, q.c_str()))
+		group = 1;
+	else
+		group = 0;
+	return score_of(group, len);
+}
+
+// path_index::add tree records
+// Adds the records of git ls-tree -r -t -z output to the index of the
+// tree, creating it if needed.
+int cmd_add(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree records");
+		return TCL_ERROR;
+	}
+	Tcl_Obj** recs;
+	int n;
+	if (Tcl_ListObjGetElements(interp, objv[2], &n, &recs) != TCL_OK)
+		return TCL_ERROR;
+
+	auto tree = tcl_string(objv[1]);
+	auto x = find(tree);
+	if (!x) {
+		indexes.emplace_front();
+		x = &indexes.front();
+		x->tree = tree;
+		while (indexes.size() > max_indexes)
+			indexes.pop_back();
+	}
+	for (int i = 0; i < n; i++)
+	{
+		int len;
+		const char* r = Tcl_GetStringFromObj(recs[i], &len);
+		auto tab = static_cast<const char*>(std::memchr(r, '\t', len));
+		if (!tab)
+			continue;
+		x->start.push_back(x->paths.size());
+		x->types += std::strncmp(r, "040000 ", 7) == 0 ? 't'
+			: std::strncmp(r, "160000 ", 7) == 0 ? 'c' : 'b';
+		x->paths.append(tab + 1, r + len - tab - 1);
+		auto slash = x->paths.rfind('/');
+		x->base.push_back(slash != std::string::npos && slash >= x->start.back()
+			? slash + 1 : x->start.back());
+		x->paths += '\0';
+	}
+	x->lower.append(lowercase(x->paths.substr(x->lower.size())));
+	for (size_t i = x->chars.size(); i < x->start.size(); i++)
+		x->chars.push_back(char_mask(x->low(i), x->length(i)));
+	return TCL_OK;
+}
+
+// path_index::done tree
+// Marks the index of the tree as complete.
+int cmd_done(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree");
+		return TCL_ERROR;
+	}
+	if (auto x = find(tcl_string(objv[1])))
+		x->complete = true;
+	return TCL_OK;
+}
+
+// path_index::state tree
+// Returns complete, partial, or none.
+int cmd_state(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree");
+		return TCL_ERROR;
+	}
+	auto x = find(tcl_string(objv[1]));
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(
+		!x ? "none" : x->complete ? "complete" : "partial", -1));
+	return TCL_OK;
+}
+
+// path_index::drop tree
+// Forgets the index of the tree, e.g. after reading it failed.
+int cmd_drop(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree");
+		return TCL_ERROR;
+	}
+	if (find(tcl_string(objv[1])))
+		indexes.pop_front();
+	return TCL_OK;
+}
+
+// path_index::match tree query limit
+// Returns the best limit matches of the query in the index of the tree as
+// a flat list of type (tree, commit or blob) and path, best first, followed by
+// the total number of matches. Case is ignored.
+int cmd_match(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int limit;
+	if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree query limit");
+		return TCL_ERROR;
+	}
+	if (!tcl_int(interp, objv[3], limit))
+		return TCL_ERROR;
+	auto x = find(tcl_string(objv[1]));
+	if (!x)
+		return TCL_OK;
+	auto q = lowercase(tcl_string(objv[2]));
+
+	// The best matches are kept in a heap with the worst of them on top.
+	typedef std::pair<uint32_t, uint32_t> Ranked;	// score and path
+	auto better = [](const Ranked& a, const Ranked& b) {
+		return a.first != b.first ? a.first > b.first : a.second < b.second;
+	};
+	size_t keep = std::max(limit, 0);
+	std::vector<Ranked> top;
+	std::vector<uint32_t> matches;
+	uint64_t need = char_mask(q.data(), q.size());
+	auto consider = [&](uint32_t i) {
+		if ((x->chars[i] & need) != need || !is_subsequence(x->low(i), q))
+			return;
+		matches.push_back(i);
+		if (!keep)
+			return;
+		// Not even the best group would do if the path is too long.
+		if (top.size() == keep && !better(Ranked(score_of(3, x->length(i)), i), top.front()))
+			return;
+		Ranked r(score(*x, i, q), i);
+		if (top.size() < keep) {
+			top.push_back(r);
+			std::push_heap(top.begin(), top.end(), better);
+		} else if (better(r, top.front())) {
+			std::pop_heap(top.begin(), top.end(), better);
+			top.back() = r;
+			std::push_heap(top.begin(), top.end(), better);
+		}
+	};
+
+	// Narrow down the matches of the last query if it is a prefix of
+	// this one; paths added since are checked, too.
+	uint32_t from = 0;
+	if (!x->last_query.empty() && q.compare(0, x->last_query.size(), x->last_query) == 0) {
+		for (auto i : x->last_matches)
+			consider(i);
+		from = x->last_size;
+	}
+	for (uint32_t i = from; i < x->start.size(); i++)
+		consider(i);
+	std::sort_heap(top.begin(), top.end(), better);
+	x->last_query = q;
+	x->last_matches.swap(matches);
+	x->last_size = x->start.size();
+
+	auto enc = Tcl_GetEncoding(nullptr, "utf-8");
+	auto result = Tcl_NewListObj(0, nullptr);
+	for (auto& r : top)
+	{
+		auto i = r.second;
+		Tcl_ListObjAppendElement(nullptr, result,
+			Tcl_NewStringObj(x->types[i] == 't' ? "tree"
+				: x->types[i] == 'c' ? "commit" : "blob", -1));
+		Tcl_ListObjAppendElement(nullptr, result,
+			decode_text(enc, x->path(i), x->length(i)));
+	}
+	Tcl_FreeEncoding(enc);
+	Tcl_ListObjAppendElement(nullptr, result, Tcl_NewIntObj(x->last_matches.size()));
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+} // namespace
+
+uint64_t char_mask(const char* s, size_t len)
+{
+	static const struct Bits
+	{
+		unsigned char of[256];
+		Bits()
+		{
+			for (int c = 0; c < 256; c++)
+				of[c] = 40 + c % 24;
+			for (int c = 'a'; c <= 'z'; c++)
+				of[c] = c - 'a';
+			for (int c = '0'; c <= '9'; c++)
+				of[c] = 26 + c - '0';
+			of['/'] = 36;
+			of['.'] = 37;
+			of['_'] = 38;
+			of['-'] = 39;
+		}
+	} bits;
+	uint64_t m = 0;
+	for (size_t i = 0; i < len; i++)
+		m |= uint64_t(1) << bits.of[static_cast<unsigned char>(s[i])];
+	return m;
+}
+
+bool is_subsequence(const char* p, const std::string& q)
+{
+	for (char c : q)
+	{
+		p = std::strchr(p, c);
+		if (!p)
+			return false;
+		p++;
+	}
+	return true;
+}
+
+void path_index_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "path_index::add", cmd_add, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "path_index::done", cmd_done, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "path_index::drop", cmd_drop, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "path_index::match", cmd_match, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "path_index::state", cmd_state, nullptr, nullptr);
+}
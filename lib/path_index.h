@@ -0,0 +1,18 @@
+// git-guing: index of all paths in a tree for "Go to file"
+
+#pragma once
+
+#include <tcl.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A set of the characters in s, for ruling out most candidates of a fuzzy
+// match without looking at them: a string can only contain the characters
+// of the query if its set has all bits of the query's set.
+uint64_t char_mask(const char* s, size_t len);
+
+// Whether the characters of q appear in the NUL terminated p in order.
+bool is_subsequence(const char* p, const std::string& q);
+
+void path_index_init(Tcl_Interp* interp);
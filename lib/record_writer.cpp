@@ -0,0 +1,172 @@
+// git-guing: streaming records to git commands that read from stdin
+
+#include "record_writer.h"
+#include "native.h"
+#include "text_input.h"
+#include <chrono>
+#include <string>
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// How long a single writable event may spend on encoding records, so that
+// the UI stays responsive while a large batch is written.
+const auto time_budget = std::chrono::milliseconds(10);
+// How often the progress command is run at most; about the refresh rate.
+const auto progress_interval = std::chrono::milliseconds(16);
+// Stop encoding records while this much output waits in the channel.
+const int high_water = 1 << 20;
+// Records are encoded into chunks of about this size before writing.
+const size_t chunk_size = 64 * 1024;
+
+struct Writer
+{
+	Tcl_Interp* interp;
+	Tcl_Channel chan;
+	Tcl_Encoding utf8;
+	Tcl_Obj* records;
+	Tcl_Obj* progress;
+	Tcl_Obj* done;
+	int next = 0;
+	int total = 0;
+	clock::time_point last_progress;
+
+	~Writer()
+	{
+		Tcl_FreeEncoding(utf8);
+		Tcl_DecrRefCount(records);
+		Tcl_DecrRefCount(progress);
+		Tcl_DecrRefCount(done);
+	}
+};
+
+void writable(ClientData data, int mask);
+void channel_closed(ClientData data);
+
+void detach(Writer* wr)
+{
+	Tcl_DeleteChannelHandler(wr->chan, writable, wr);
+	Tcl_DeleteCloseHandler(wr->chan, channel_closed, wr);
+}
+
+void channel_closed(ClientData data)
+{
+	auto wr = static_cast<Writer*>(data);
+	Tcl_DeleteChannelHandler(wr->chan, writable, wr);
+	delete wr;
+}
+
+// Runs the command with the number of records written so far and the
+// total number of records appended.
+int run_progress(Writer* wr)
+{
+	Tcl_Obj* cmd = Tcl_DuplicateObj(wr->progress);
+	Tcl_IncrRefCount(cmd);
+	Tcl_ListObjAppendElement(nullptr, cmd, Tcl_NewIntObj(wr->next));
+	Tcl_ListObjAppendElement(nullptr, cmd, Tcl_NewIntObj(wr->total));
+	int rc = Tcl_EvalObjEx(wr->interp, cmd, TCL_EVAL_GLOBAL);
+	Tcl_DecrRefCount(cmd);
+	wr->last_progress = clock::now();
+	return rc;
+}
+
+void writable(ClientData data, int)
+{
+	auto wr = static_cast<Writer*>(data);
+	auto start = clock::now();
+	Tcl_Obj** recs;
+	int n;
+	Tcl_ListObjGetElements(nullptr, wr->records, &n, &recs);
+
+	std::string chunk;
+	bool failed = false;
+	while (wr->next < wr->total && Tcl_OutputBuffered(wr->chan) < high_water) {
+		while (wr->next < wr->total && chunk.size() < chunk_size) {
+			encode_text(wr->utf8, recs[wr->next++], chunk);
+			chunk += '\0';
+		}
+		if (Tcl_Write(wr->chan, chunk.data(), chunk.size()) < 0) {
+			failed = true;
+			break;
+		}
+		chunk.clear();
+		if (clock::now() - start >= time_budget)
+			break;
+	}
+	failed = failed || Tcl_Flush(wr->chan) != TCL_OK;
+
+	Tcl_Interp* interp = wr->interp;
+	if (wr->next < wr->total && !failed) {
+		if (clock::now() - wr->last_progress >= progress_interval
+		    && run_progress(wr) != TCL_OK)
+			Tcl_BackgroundException(interp, TCL_ERROR);
+		return;
+	}
+
+	// All is written, or git went away; closing the channel will tell.
+	// The done command closes the channel, so let go of it first.
+	detach(wr);
+	Tcl_Preserve(interp);
+	if (run_progress(wr) != TCL_OK)
+		Tcl_BackgroundException(interp, TCL_ERROR);
+	Tcl_Obj* done = wr->done;
+	Tcl_IncrRefCount(done);
+	delete wr;
+	if (Tcl_EvalObjEx(interp, done, TCL_EVAL_GLOBAL) != TCL_OK)
+		Tcl_BackgroundException(interp, TCL_ERROR);
+	Tcl_DecrRefCount(done);
+	Tcl_Release(interp);
+}
+
+// write_records fd records progress done
+// Writes the records, each terminated by NUL and encoded in UTF-8, to the
+// non-blocking binary channel fd in the background, as fast as the reader
+// takes them. The command prefix progress is run with the number of
+// records written and the total count, no more often than the screen
+// refreshes. Once everything is written, the script done is run; it is
+// expected to close the channel.
+int cmd_write_records(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 5) {
+		Tcl_WrongNumArgs(interp, 1, objv, "fd records progress done");
+		return TCL_ERROR;
+	}
+	int mode;
+	Tcl_Channel chan = Tcl_GetChannel(interp, Tcl_GetString(objv[1]), &mode);
+	if (!chan)
+		return TCL_ERROR;
+	if (!(mode & TCL_WRITABLE)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+			"channel \"%s\" wasn't opened for writing", Tcl_GetString(objv[1])));
+		return TCL_ERROR;
+	}
+	int total, progress_words;
+	if (Tcl_ListObjLength(interp, objv[2], &total) != TCL_OK
+	    || Tcl_ListObjLength(interp, objv[3], &progress_words) != TCL_OK)
+		return TCL_ERROR;
+
+	auto wr = new Writer;
+	wr->interp = interp;
+	wr->chan = chan;
+	wr->utf8 = Tcl_GetEncoding(nullptr, "utf-8");
+	wr->records = objv[2];
+	wr->progress = objv[3];
+	wr->done = objv[4];
+	wr->total = total;
+	wr->last_progress = clock::now();
+	Tcl_IncrRefCount(wr->records);
+	Tcl_IncrRefCount(wr->progress);
+	Tcl_IncrRefCount(wr->done);
+
+	Tcl_CreateCloseHandler(chan, channel_closed, wr);
+	Tcl_CreateChannelHandler(chan, TCL_WRITABLE, writable, wr);
+	return TCL_OK;
+}
+
+} // namespace
+
+void record_writer_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "write_records", cmd_write_records, nullptr, nullptr);
+}
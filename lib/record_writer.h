@@ -0,0 +1,7 @@
+// git-guing: streaming records to git commands that read from stdin
+
+#pragma once
+
+#include <tcl.h>
+
+void record_writer_init(Tcl_Interp* interp);
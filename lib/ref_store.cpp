@@ -0,0 +1,503 @@
+// git-guing: process-wide store of refs
+//
+// The revision chooser and the branch dialogs list all branches, remote
+// tracking branches, or tags. The refs of a namespace, e.g. refs/tags, are
+// read with one git for-each-ref and kept until the files behind it
+// change: packed-refs, or any directory below refs/tags, which git touches
+// whenever it writes or deletes a loose ref. Only namespaces that changed
+// are read again. What for-each-ref tells about the commits at the tips is
+// passed on to the commit store.
+//
+// Each ref is kept as one string of NUL terminated fields in the text of
+// its namespace, in the order git for-each-ref --sort=-taggerdate lists
+// them.
+
+#include "ref_store.h"
+#include "commit_store.h"
+#include "native.h"
+#include "text_input.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// What for-each-ref reports of each ref, and the fields kept of it.
+const char format[] =
+	"--format=%(refname)%00%(objecttype)%00%(objectname)"
+	"%00%(taggername)%00%(taggerdate:raw)%00%(subject)"
+	"%00%(*objecttype)%00%(*objectname)"
+	"%00%(authorname)%00%(authordate:raw)"
+	"%00%(*authorname)%00%(*authordate:raw)%00%(*subject)";
+enum {
+	in_refname, in_type, in_object, in_tagger, in_tagger_date, in_subject,
+	in_peeled_type, in_peeled, in_author, in_author_date,
+	in_peeled_author, in_peeled_author_date, in_peeled_subject,
+	in_fields
+};
+enum {
+	f_refname, f_type, f_object, f_tagger, f_tagger_time, f_subject,
+	f_commit,	// the commit the ref points to, if any, maybe through a tag
+};
+
+struct Namespace
+{
+	std::string signature;		// of the files behind it when read
+	bool racy = false;		// they changed in the second they were read
+	std::string text;
+	std::vector<uint32_t> refs;	// offset of the fields of each ref
+};
+
+std::map<std::string, Namespace> namespaces;	// by name, e.g. refs/heads
+
+// The time of the last entry of a reflog, as long as the file keeps its
+// size and mtime.
+struct LastUpdate
+{
+	uintmax_t size;
+	std::time_t mtime;
+	std::string when;
+};
+
+std::map<std::string, LastUpdate> last_updates;	// by ref name
+
+const char* field(const std::string& text, uint32_t at, int i)
+{
+	const char* p = text.c_str() + at;
+	while (i--)
+		p += std::strlen(p) + 1;
+	return p;
+}
+
+// refs/heads for refs/heads/topic, or an empty string if name is outside
+// of refs/.
+std::string namespace_of(const std::string& name)
+{
+	if (name.compare(0, 5, "refs/") != 0)
+		return std::string();
+	auto slash = name.find('/', 5);
+	return slash == std::string::npos ? name : name.substr(0, slash);
+}
+
+// Whether the ref name matches the prefix like a pattern of git
+// for-each-ref without wildcards: up to a slash or entirely.
+bool has_prefix(const char* refname, const std::string& prefix)
+{
+	if (std::strncmp(refname, prefix.c_str(), prefix.size()) != 0)
+		return false;
+	char next = refname[prefix.size()];
+	return next == '\0' || next == '/' || prefix.back() == '/';
+}
+
+fs::path common_dir(Tcl_Interp* interp)
+{
+	if (Tcl_Eval(interp, "gitdir") != TCL_OK) {
+		Tcl_ResetResult(interp);
+		return fs::path();
+	}
+	fs::path dir(Tcl_GetStringResult(interp));
+	Tcl_ResetResult(interp);
+
+	// Branches and tags of linked worktrees live in the main repository.
+	auto chan = Tcl_OpenFileChannel(nullptr, (dir / "commondir").string().c_str(), "r", 0);
+	if (chan) {
+		Tcl_Obj* line = Tcl_NewObj();
+		Tcl_IncrRefCount(line);
+		if (Tcl_GetsObj(chan, line) > 0) {
+			fs::path common(Tcl_GetString(line));
+			dir = common.is_absolute() ? common : dir / common;
+		}
+		Tcl_DecrRefCount(line);
+		Tcl_Close(nullptr, chan);
+	}
+	return dir;
+}
+
+void stamp(const fs::path& p, bool with_size, std::string& sig, std::time_t& newest)
+{
+	boost::system::error_code ec;
+	auto t = fs::last_write_time(p, ec);
+	if (ec)
+		return;
+	sig += p.string();
+	sig += ' ';
+	sig += std::to_string(t);
+	if (with_size) {
+		sig += ' ';
+		sig += std::to_string(fs::file_size(p, ec));
+	}
+	sig += '\n';
+	newest = std::max(newest, t);
+}
+
+// Describes the state of the files behind the namespace.
+std::string signature(const fs::path& dir, const std::string& name, std::time_t& newest)
+{
+	std::string sig;
+	stamp(dir / "packed-refs", true, sig, newest);
+	stamp(dir / "reftable" / "tables.list", true, sig, newest);
+	auto root = dir / name;
+	stamp(root, false, sig, newest);
+	boost::system::error_code ec;
+	for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec))
+	{
+		if (fs::is_directory(it->status()))
+			stamp(it->path(), false, sig, newest);
+	}
+	return sig;
+}
+
+// Runs git for-each-ref on the namespace and returns its output.
+bool read_refs(Tcl_Interp* interp, const std::string& name, std::string& out)
+{
+	Tcl_Obj* cmd[] = {
+		Tcl_NewStringObj("git_read", -1),
+		Tcl_NewStringObj("for-each-ref", -1),
+		Tcl_NewStringObj("--sort=-taggerdate", -1),
+		Tcl_NewStringObj(format, -1),
+		tcl_obj(name),
+	};
+	for (auto o : cmd)
+		Tcl_IncrRefCount(o);
+	int rc = Tcl_EvalObjv(interp, 5, cmd, TCL_EVAL_GLOBAL);
+	for (auto o : cmd)
+		Tcl_DecrRefCount(o);
+	Tcl_Channel chan = nullptr;
+	if (rc == TCL_OK)
+		chan = Tcl_GetChannel(interp, Tcl_GetStringResult(interp), nullptr);
+	Tcl_ResetResult(interp);
+	if (!chan)
+		return false;
+
+	Tcl_SetChannelOption(nullptr, chan, "-translation", "binary");
+	Tcl_SetChannelOption(nullptr, chan, "-blocking", "1");
+	char chunk[65536];
+	int got;
+	while ((got = Tcl_Read(chan, chunk, sizeof(chunk))) > 0)
+		out.append(chunk, got);
+	Tcl_UnregisterChannel(interp, chan);
+	return got == 0;
+}
+
+void parse(Namespace& ns, const std::string& out)
+{
+	ns.text.clear();
+	ns.refs.clear();
+	auto enc = Tcl_GetEncoding(nullptr, "utf-8");
+	std::vector<std::string> in(in_fields);
+	for (size_t p = 0; p < out.size(); )
+	{
+		auto nl = out.find('\n', p);
+		if (nl == std::string::npos)
+			nl = out.size();
+		size_t i = 0;
+		for (size_t f = p; i < in_fields && f <= nl; i++)
+		{
+			auto e = std::min(out.find('\0', f), nl);
+			auto obj = decode_text(enc, out.data() + f, e - f);
+			Tcl_IncrRefCount(obj);
+			in[i] = Tcl_GetString(obj);
+			Tcl_DecrRefCount(obj);
+			f = e + 1;
+		}
+		p = nl + 1;
+		if (i < in_fields)
+			continue;
+
+		std::string commit;
+		if (in[in_type] == "commit") {
+			commit = in[in_object];
+			auto& date = in[in_author_date];
+			commit_learn(commit, "author", in[in_author]);
+			commit_learn(commit, "author-time", date.substr(0, date.find(' ')));
+			commit_learn(commit, "summary", in[in_subject]);
+		} else if (in[in_type] == "tag" && in[in_peeled_type] == "commit") {
+			commit = in[in_peeled];
+			auto& date = in[in_peeled_author_date];
+			commit_learn(commit, "author", in[in_peeled_author]);
+			commit_learn(commit, "author-time", date.substr(0, date.find(' ')));
+			commit_learn(commit, "summary", in[in_peeled_subject]);
+		}
+
+		bool tag = in[in_type] == "tag";
+		const std::string* keep[] = {
+			&in[in_refname], &in[in_type], &in[in_object],
+			tag ? &in[in_tagger] : nullptr,
+			tag ? &in[in_tagger_date] : nullptr,
+			tag ? &in[in_subject] : nullptr,
+			&commit,
+		};
+		ns.refs.push_back(ns.text.size());
+		for (auto s : keep)
+		{
+			if (s == &in[in_tagger_date])
+				ns.text.append(*s, 0, s->find(' '));
+			else if (s)
+				ns.text += *s;
+			ns.text += '\0';
+		}
+	}
+	Tcl_FreeEncoding(enc);
+	ns.text.shrink_to_fit();
+	ns.refs.shrink_to_fit();
+}
+
+// Reads the namespace again if the files behind it changed since it was
+// read last.
+Namespace& refresh(Tcl_Interp* interp, const fs::path& dir, const std::string& name)
+{
+	auto& ns = namespaces[name];
+	std::time_t newest = 0;
+	auto sig = signature(dir, name, newest);
+	if (sig == ns.signature && !ns.racy)
+		return ns;
+
+	// A change in the same second as reading would go unnoticed.
+	auto now = std::time(nullptr);
+	std::string out;
+	if (read_refs(interp, name, out)) {
+		parse(ns, out);
+		ns.signature = sig;
+		ns.racy = newest >= now;
+	}
+	return ns;
+}
+
+// Calls fn with the fields of each ref that matches one of the prefixes,
+// in the order of the namespaces of the prefixes.
+template<typename Fn>
+bool each_ref(Tcl_Interp* interp, int objc, Tcl_Obj* const objv[], Fn fn)
+{
+	if (objc < 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "prefix ?prefix ...?");
+		return false;
+	}
+	std::vector<std::pair<std::string, std::vector<std::string>>> todo;
+	for (int i = 1; i < objc; i++)
+	{
+		auto prefix = tcl_string(objv[i]);
+		auto name = namespace_of(prefix);
+		if (name.empty() || prefix.empty())
+			continue;
+		size_t n = 0;
+		while (n < todo.size() && todo[n].first != name)
+			n++;
+		if (n == todo.size())
+			todo.emplace_back(name, std::vector<std::string>());
+		todo[n].second.push_back(prefix);
+	}
+	if (todo.empty())
+		return true;
+
+	auto dir = common_dir(interp);
+	for (auto& t : todo)
+	{
+		auto& ns = refresh(interp, dir, t.first);
+		for (auto at : ns.refs)
+		{
+			const char* refname = field(ns.text, at, f_refname);
+			for (auto& prefix : t.second)
+			{
+				if (has_prefix(refname, prefix)) {
+					fn(ns.text, at);
+					break;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// ref_store::list prefix ?prefix ...?
+// Returns the names of the refs below the prefixes, e.g. refs/heads or
+// refs/remotes/origin, which match like the patterns of git for-each-ref
+// but without wildcards. Namespaces are read again if they changed.
+int cmd_list(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	auto result = Tcl_NewListObj(0, nullptr);
+	bool ok = each_ref(interp, objc, objv, [&](const std::string& text, uint32_t at) {
+		Tcl_ListObjAppendElement(nullptr, result,
+			Tcl_NewStringObj(field(text, at, f_refname), -1));
+	});
+	if (!ok) {
+		Tcl_DecrRefCount(result);
+		return TCL_ERROR;
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// ref_store::commits prefix ?prefix ...?
+// Like ref_store::list, but only lists refs that point to a commit,
+// directly or through a tag, as a flat list of ref name and commit id.
+int cmd_commits(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	auto result = Tcl_NewListObj(0, nullptr);
+	bool ok = each_ref(interp, objc, objv, [&](const std::string& text, uint32_t at) {
+		const char* commit = field(text, at, f_commit);
+		if (!*commit)
+			return;
+		Tcl_ListObjAppendElement(nullptr, result,
+			Tcl_NewStringObj(field(text, at, f_refname), -1));
+		Tcl_ListObjAppendElement(nullptr, result, Tcl_NewStringObj(commit, -1));
+	});
+	if (!ok) {
+		Tcl_DecrRefCount(result);
+		return TCL_ERROR;
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// ref_store::tip refname
+// Describes what the ref pointed to when it was last listed: a list of
+// {tag id tagger time subject} if it is an annotated tag, followed by
+// {commit id} if it points to a commit. Returns an empty list for
+// unknown refs.
+int cmd_tip(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "refname");
+		return TCL_ERROR;
+	}
+	auto refname = tcl_string(objv[1]);
+	auto it = namespaces.find(namespace_of(refname));
+	if (it == namespaces.end())
+		return TCL_OK;
+	auto& text = it->second.text;
+	auto result = Tcl_NewListObj(0, nullptr);
+	for (auto at : it->second.refs)
+	{
+		if (refname != field(text, at, f_refname))
+			continue;
+		if (std::strcmp(field(text, at, f_type), "tag") == 0) {
+			Tcl_Obj* tag[] = {
+				Tcl_NewStringObj("tag", -1),
+				Tcl_NewStringObj(field(text, at, f_object), -1),
+				Tcl_NewStringObj(field(text, at, f_tagger), -1),
+				Tcl_NewStringObj(field(text, at, f_tagger_time), -1),
+				Tcl_NewStringObj(field(text, at, f_subject), -1),
+			};
+			Tcl_ListObjAppendElement(nullptr, result, Tcl_NewListObj(5, tag));
+		}
+		if (*field(text, at, f_commit)) {
+			Tcl_Obj* commit[] = {
+				Tcl_NewStringObj("commit", -1),
+				Tcl_NewStringObj(field(text, at, f_commit), -1),
+			};
+			Tcl_ListObjAppendElement(nullptr, result, Tcl_NewListObj(2, commit));
+		}
+		break;
+	}
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// The time in the last entry of the reflog that has one, which is read
+// backwards from the end in blocks.
+std::string last_entry_time(const fs::path& log, uintmax_t size)
+{
+	auto chan = Tcl_OpenFileChannel(nullptr, log.string().c_str(), "r", 0);
+	if (!chan)
+		return std::string();
+	Tcl_SetChannelOption(nullptr, chan, "-translation", "binary");
+
+	const uintmax_t block = 4096;
+	std::string tail;	// the end of the file that was read
+	uintmax_t at = size;
+	size_t line_end = std::string::npos;	// in tail, of the line to look at
+	std::string when;
+	while (when.empty() && at > 0) {
+		uintmax_t n = std::min(at, block);
+		at -= n;
+		std::string buf(n, '\0');
+		if (Tcl_Seek(chan, at, SEEK_SET) < 0 || Tcl_Read(chan, &buf[0], n) != int(n))
+			break;
+		tail.insert(0, buf);
+		if (line_end != std::string::npos)
+			line_end += n;
+		else
+			line_end = tail.size();
+
+		// Look at the lines that are complete now, last first.
+		for (;;)
+		{
+			auto start = line_end == 0 ? std::string::npos : tail.rfind('\n', line_end - 1);
+			if (start == std::string::npos && at > 0)
+				break;
+			start = start == std::string::npos ? 0 : start + 1;
+
+			// "<old> <new> <name> <<mail>> <time> <tz>\t<message>"
+			auto line = tail.substr(start, line_end - start);
+			auto gt = line.rfind("> ", line.find('\t'));
+			if (gt != std::string::npos) {
+				auto digits = line.find_first_not_of("0123456789", gt + 2);
+				if (digits != gt + 2 && line[gt + 2] != '0' && digits < line.size() && line[digits] == ' ')
+					when = line.substr(gt + 2, digits - gt - 2);
+			}
+			if (!when.empty() || start == 0)
+				break;
+			line_end = start - 1;
+		}
+		tail.erase(line_end);
+	}
+	Tcl_Close(nullptr, chan);
+	return when;
+}
+
+// ref_store::updated refname
+// Returns when the ref was updated last, in seconds since the epoch: the
+// mtime of its loose ref file, or else the time of the last entry of its
+// reflog. Returns an empty string if neither is known.
+int cmd_updated(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "refname");
+		return TCL_ERROR;
+	}
+	auto refname = tcl_string(objv[1]);
+	auto dir = common_dir(interp);
+	if (namespace_of(refname).empty() || dir.empty())
+		return TCL_OK;
+
+	boost::system::error_code ec;
+	auto mtime = fs::last_write_time(dir / refname, ec);
+	if (!ec) {
+		Tcl_SetObjResult(interp, tcl_obj(std::to_string(mtime)));
+		return TCL_OK;
+	}
+
+	auto log = dir / "logs" / refname;
+	auto size = fs::file_size(log, ec);
+	if (!ec)
+		mtime = fs::last_write_time(log, ec);
+	if (ec) {
+		last_updates.erase(refname);
+		return TCL_OK;
+	}
+	auto& u = last_updates[refname];
+	if (u.when.empty() || u.size != size || u.mtime != mtime) {
+		u.size = size;
+		u.mtime = mtime;
+		u.when = last_entry_time(log, size);
+	}
+	Tcl_SetObjResult(interp, tcl_obj(u.when));
+	return TCL_OK;
+}
+
+} // namespace
+
+void ref_store_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "ref_store::commits", cmd_commits, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "ref_store::list", cmd_list, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "ref_store::tip", cmd_tip, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "ref_store::updated", cmd_updated, nullptr, nullptr);
+}
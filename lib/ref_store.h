@@ -0,0 +1,7 @@
+// git-guing: process-wide store of refs
+
+#pragma once
+
+#include <tcl.h>
+
+void ref_store_init(Tcl_Interp* interp);
@@ -35,8 +35,7 @@ proc all_tracking_branches {} {
 	}
 
 	if {$pat ne {}} {
-		set fd [eval git_read for-each-ref --format=%(refname) $cmd]
-		while {[gets $fd n] > 0} {
+		foreach n [eval ref_store::list $cmd] {
 			foreach spec $pat {
 				set dst [string range [lindex $spec 0] 0 end-2]
 				set len [string length $dst]
@@ -51,7 +50,6 @@ proc all_tracking_branches {} {
 				}
 			}
 		}
-		close $fd
 	}
 
 	return [lsort -index 0 -unique $all]
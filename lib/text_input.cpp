@@ -0,0 +1,491 @@
+// git-guing: native helpers for reading text from files and git
+
+#include "text_input.h"
+#include "native.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// git looks at this many bytes to decide whether a file is binary.
+const size_t sniff_len = 8000;
+
+} // namespace
+
+namespace {
+
+// Skips whole blocks of ASCII bytes starting at s[i], which make up most of
+// the text that git produces, and returns the index of the first block that
+// needs a closer look. If no_nul is true, blocks with NUL bytes are not
+// skipped either.
+size_t skip_ascii(const unsigned char* s, size_t i, size_t len, bool no_nul)
+{
+#ifdef __AVX2__
+	const __m256i zero32 = _mm256_setzero_si256();
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+		int m = _mm256_movemask_epi8(v);
+		if (no_nul)
+			m |= _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero32));
+		if (m)
+			break;
+	}
+#endif
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+		int m = _mm_movemask_epi8(v);
+		if (no_nul)
+			m |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		if (m)
+			break;
+	}
+#else
+	(void)s, (void)len, (void)no_nul;
+#endif
+	return i;
+}
+
+// The UTF-8 validator behind is_valid_utf8() and is_tcl_utf8(). With
+// for_tcl, NUL bytes and characters that Tcl cannot represent directly in
+// its internal encoding are rejected as well.
+bool check_utf8(const char* p, size_t len, bool partial_tail, bool for_tcl)
+{
+	auto s = reinterpret_cast<const unsigned char*>(p);
+	size_t i = 0;
+	while (i < len) {
+		i = skip_ascii(s, i, len, for_tcl);
+		while (i < len && s[i] < 0x80) {
+			if (for_tcl && s[i] == 0)
+				return false;
+			i++;
+		}
+		if (i == len)
+			break;
+
+		unsigned c = s[i];
+		size_t n;
+		unsigned min;
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 1, min = 0x80;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			n = 2, min = 0x800;
+		} else if (c >= 0xf0 && c <= 0xf4 && (!for_tcl || TCL_UTF_MAX > 3)) {
+			n = 3, min = 0x10000;
+		} else {
+			return false;
+		}
+		if (i + n >= len) {
+			// the sequence is cut off by the end of the buffer
+			if (!partial_tail)
+				return false;
+			for (size_t k = i + 1; k < len; k++)
+				if ((s[k] & 0xc0) != 0x80)
+					return false;
+			return true;
+		}
+		unsigned cp = c & (0x3f >> n);
+		for (size_t k = 1; k <= n; k++)
+		{
+			if ((s[i + k] & 0xc0) != 0x80)
+				return false;
+			cp = (cp << 6) | (s[i + k] & 0x3f);
+		}
+		if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+			return false;
+		i += n + 1;
+	}
+	return true;
+}
+
+} // namespace
+
+bool is_valid_utf8(const char* p, size_t len, bool partial_tail)
+{
+	return check_utf8(p, len, partial_tail, false);
+}
+
+bool is_tcl_utf8(const char* p, size_t len)
+{
+	return check_utf8(p, len, false, true);
+}
+
+Tcl_Obj* decode_text(Tcl_Encoding enc, const char* p, size_t len)
+{
+	if (std::strcmp(Tcl_GetEncodingName(enc), "utf-8") == 0
+	    && is_tcl_utf8(p, len))
+		return Tcl_NewStringObj(p, len);
+
+	Tcl_DString ds;
+	Tcl_ExternalToUtfDString(enc, p, len, &ds);
+	auto obj = Tcl_NewStringObj(Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+	Tcl_DStringFree(&ds);
+	return obj;
+}
+
+void encode_text(Tcl_Encoding enc, Tcl_Obj* obj, std::string& out)
+{
+	int len;
+	const char* p = Tcl_GetStringFromObj(obj, &len);
+	if (std::strcmp(Tcl_GetEncodingName(enc), "utf-8") == 0
+	    && is_tcl_utf8(p, len)) {
+		out.append(p, len);
+		return;
+	}
+
+	Tcl_DString ds;
+	Tcl_UtfToExternalDString(enc, p, len, &ds);
+	out.append(Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+	Tcl_DStringFree(&ds);
+}
+
+bool looks_binary(const char* p, size_t len)
+{
+	return std::memchr(p, 0, std::min(len, sniff_len)) != nullptr;
+}
+
+namespace {
+
+// The length of the longest prefix of p that does not end in the middle
+// of a UTF-8 sequence.
+size_t utf8_boundary(const char* p, size_t len)
+{
+	auto s = reinterpret_cast<const unsigned char*>(p);
+	size_t i = len;
+	// step back over at most 3 continuation bytes
+	while (i > 0 && len - i < 3 && (s[i - 1] & 0xc0) == 0x80)
+		i--;
+	if (i == 0 || s[i - 1] < 0xc0)
+		return len;
+	// s[i - 1] is a lead byte; is its sequence complete?
+	unsigned c = s[i - 1];
+	size_t need = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+	return len - (i - 1) >= need ? len : i - 1;
+}
+
+// preview_file path limit check_utf8
+// Reads at most limit bytes from the start of the file and returns a list
+// of the file size, the bytes read (as a byte array), and whether the
+// file looks binary. The content of binary files is not returned. If
+// check_utf8 is true, the file is also considered binary if the sniffed
+// part is not valid UTF-8, and the content is cut at a character boundary.
+int cmd_preview_file(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int limit, check_utf8;
+	if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "path limit check_utf8");
+		return TCL_ERROR;
+	}
+	if (!tcl_int(interp, objv[2], limit)
+	    || Tcl_GetBooleanFromObj(interp, objv[3], &check_utf8) != TCL_OK)
+		return TCL_ERROR;
+	limit = std::max(limit, 0);
+
+	auto chan = Tcl_FSOpenFileChannel(interp, objv[1], "r", 0);
+	if (!chan)
+		return TCL_ERROR;
+	Tcl_SetChannelOption(interp, chan, "-translation", "binary");
+	Tcl_WideInt size = Tcl_Seek(chan, 0, SEEK_END);
+	Tcl_Seek(chan, 0, SEEK_SET);
+
+	// Never read more than the limit, but always enough to sniff.
+	std::vector<char> buf(std::max<Tcl_WideInt>(0,
+		std::min<Tcl_WideInt>(size, std::max<size_t>(limit, sniff_len))));
+	int got = buf.empty() ? 0 : Tcl_Read(chan, buf.data(), buf.size());
+	Tcl_Close(nullptr, chan);
+	buf.resize(std::max(got, 0));
+
+	auto sniff = std::min(buf.size(), sniff_len);
+	bool binary = looks_binary(buf.data(), buf.size())
+		|| (check_utf8 && !is_valid_utf8(buf.data(), sniff, Tcl_WideInt(sniff) < size));
+
+	size_t keep = 0;
+	if (!binary) {
+		keep = std::min(buf.size(), size_t(limit));
+		if (check_utf8)
+			keep = utf8_boundary(buf.data(), keep);
+	}
+
+	Tcl_Obj* r[3] = {
+		Tcl_NewWideIntObj(size),
+		Tcl_NewByteArrayObj(reinterpret_cast<unsigned char*>(buf.data()), keep),
+		Tcl_NewBooleanObj(binary),
+	};
+	Tcl_SetObjResult(interp, Tcl_NewListObj(3, r));
+	return TCL_OK;
+}
+
+// Input read from a channel that does not yet make up a complete line or
+// record, by channel. Entries are dropped when the channel is closed.
+std::map<Tcl_Channel, std::string> pending;
+
+void drop_pending(ClientData chan)
+{
+	pending.erase(static_cast<Tcl_Channel>(chan));
+}
+
+// Reads everything that is available from the binary channel and returns
+// it together with the input left over from the previous call.
+bool read_available(Tcl_Interp* interp, Tcl_Obj* name, Tcl_Channel& chan, std::string*& buf)
+{
+	int mode;
+	chan = Tcl_GetChannel(interp, Tcl_GetString(name), &mode);
+	if (!chan)
+		return false;
+	if (!(mode & TCL_READABLE)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+			"channel \"%s\" wasn't opened for reading", Tcl_GetString(name)));
+		return false;
+	}
+
+	auto it = pending.find(chan);
+	if (it == pending.end()) {
+		it = pending.emplace(chan, std::string()).first;
+		Tcl_CreateCloseHandler(chan, drop_pending, chan);
+	}
+	buf = &it->second;
+
+	char chunk[65536];
+	for (;;)
+	{
+		int got = Tcl_Read(chan, chunk, sizeof(chunk));
+		if (got < 0) {
+			if (Tcl_InputBlocked(chan))
+				break;
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+				"error reading \"%s\": %s", Tcl_GetString(name),
+				Tcl_ErrnoMsg(Tcl_GetErrno())));
+			return false;
+		}
+		buf->append(chunk, got);
+		if (got < int(sizeof(chunk)))
+			break;
+	}
+	return true;
+}
+
+// read_lines fd encoding
+// Reads all available input from the binary channel fd and returns the
+// complete lines in it, decoded from the given encoding, without their
+// line feeds. An incomplete last line is kept for the next call, or is
+// returned once the end of the input is reached, just like gets would.
+int cmd_read_lines(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "fd encoding");
+		return TCL_ERROR;
+	}
+	Tcl_Channel chan;
+	std::string* buf;
+	if (!read_available(interp, objv[1], chan, buf))
+		return TCL_ERROR;
+	auto enc = Tcl_GetEncoding(interp, Tcl_GetString(objv[2]));
+	if (!enc)
+		return TCL_ERROR;
+
+	auto result = Tcl_NewListObj(0, nullptr);
+	size_t start = 0;
+	for (size_t nl; (nl = buf->find('\n', start)) != std::string::npos; start = nl + 1)
+	{
+		Tcl_ListObjAppendElement(nullptr, result,
+			decode_text(enc, buf->data() + start, nl - start));
+	}
+	if (start < buf->size() && Tcl_Eof(chan)) {
+		Tcl_ListObjAppendElement(nullptr, result,
+			decode_text(enc, buf->data() + start, buf->size() - start));
+		start = buf->size();
+	}
+	buf->erase(0, start);
+	Tcl_FreeEncoding(enc);
+
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// Joins the lines in p, up to the last line feed, or all of them if all
+// is true, into one string without carriage returns at the line ends, and
+// returns {count text} of it decoded from enc. used is set to the number
+// of bytes that were taken.
+Tcl_Obj* text_block(Tcl_Encoding enc, const char* p, size_t len, bool all, size_t& used)
+{
+	std::string out;
+	out.reserve(len);
+	int count = 0;
+	size_t start = 0;
+	while (start < len) {
+		auto nl = static_cast<const char*>(std::memchr(p + start, '\n', len - start));
+		if (!nl && !all)
+			break;
+		size_t end = nl ? nl - p : len;
+		size_t e = end;
+		if (e > start && p[e - 1] == '\r')
+			e--;
+		if (count++)
+			out += '\n';
+		out.append(p + start, e - start);
+		start = end + 1;
+	}
+	used = std::min(start, len);
+
+	Tcl_Obj* r[2] = {
+		Tcl_NewIntObj(count),
+		decode_text(enc, out.data(), out.size()),
+	};
+	return Tcl_NewListObj(2, r);
+}
+
+// read_text fd encoding
+// Like read_lines, but returns the complete lines as {count text}, where
+// text holds them joined by line feeds, with carriage returns at the line
+// ends removed.
+int cmd_read_text(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "fd encoding");
+		return TCL_ERROR;
+	}
+	Tcl_Channel chan;
+	std::string* buf;
+	if (!read_available(interp, objv[1], chan, buf))
+		return TCL_ERROR;
+	auto enc = Tcl_GetEncoding(interp, Tcl_GetString(objv[2]));
+	if (!enc)
+		return TCL_ERROR;
+
+	size_t used;
+	Tcl_SetObjResult(interp,
+		text_block(enc, buf->data(), buf->size(), Tcl_Eof(chan), used));
+	buf->erase(0, used);
+	Tcl_FreeEncoding(enc);
+	return TCL_OK;
+}
+
+// read_file_text path encoding
+// Reads the whole file in one go and returns its lines like read_text.
+int cmd_read_file_text(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "path encoding");
+		return TCL_ERROR;
+	}
+	auto enc = Tcl_GetEncoding(interp, Tcl_GetString(objv[2]));
+	if (!enc)
+		return TCL_ERROR;
+	auto chan = Tcl_FSOpenFileChannel(interp, objv[1], "r", 0);
+	if (!chan) {
+		Tcl_FreeEncoding(enc);
+		return TCL_ERROR;
+	}
+	Tcl_SetChannelOption(interp, chan, "-translation", "binary");
+
+	std::string buf;
+	Tcl_WideInt size = Tcl_Seek(chan, 0, SEEK_END);
+	Tcl_Seek(chan, 0, SEEK_SET);
+	if (size > 0) {
+		buf.resize(size);
+		int got = Tcl_Read(chan, &buf[0], size);
+		buf.resize(std::max(got, 0));
+	}
+	// the file may have grown, or may not be seekable
+	char chunk[65536];
+	int got;
+	while ((got = Tcl_Read(chan, chunk, sizeof(chunk))) > 0)
+		buf.append(chunk, got);
+	Tcl_Close(nullptr, chan);
+
+	size_t used;
+	Tcl_SetObjResult(interp, text_block(enc, buf.data(), buf.size(), true, used));
+	Tcl_FreeEncoding(enc);
+	return TCL_OK;
+}
+
+// read_fields fd count
+// Reads all available input from the binary channel fd, which carries
+// NUL terminated UTF-8 fields as in the output of git commands run with
+// -z, and returns the fields of all complete records of count fields.
+int cmd_read_fields(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int count;
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "fd count");
+		return TCL_ERROR;
+	}
+	if (!tcl_int(interp, objv[2], count))
+		return TCL_ERROR;
+	count = std::max(count, 1);
+	Tcl_Channel chan;
+	std::string* buf;
+	if (!read_available(interp, objv[1], chan, buf))
+		return TCL_ERROR;
+	auto enc = Tcl_GetEncoding(nullptr, "utf-8");
+
+	auto result = Tcl_NewListObj(0, nullptr);
+	size_t start = 0;
+	for (;;)
+	{
+		// find the end of the next complete record
+		size_t end = start;
+		int n = 0;
+		for (; n < count; n++)
+		{
+			auto z = std::memchr(buf->data() + end, 0, buf->size() - end);
+			if (!z)
+				break;
+			end = static_cast<const char*>(z) - buf->data() + 1;
+		}
+		if (n < count)
+			break;
+		while (start < end) {
+			size_t z = buf->find('\0', start);
+			Tcl_ListObjAppendElement(nullptr, result,
+				decode_text(enc, buf->data() + start, z - start));
+			start = z + 1;
+		}
+	}
+	buf->erase(0, start);
+	Tcl_FreeEncoding(enc);
+
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// decode_text data ?encoding?
+// Converts the byte array data from the encoding, utf-8 by default, like
+// encoding convertfrom does, but passes valid UTF-8 straight through.
+int cmd_decode_text(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2 && objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "data ?encoding?");
+		return TCL_ERROR;
+	}
+	auto enc = Tcl_GetEncoding(interp, objc == 3 ? Tcl_GetString(objv[2]) : "utf-8");
+	if (!enc)
+		return TCL_ERROR;
+	int len;
+	auto data = Tcl_GetByteArrayFromObj(objv[1], &len);
+	Tcl_SetObjResult(interp, decode_text(enc, reinterpret_cast<const char*>(data), len));
+	Tcl_FreeEncoding(enc);
+	return TCL_OK;
+}
+
+} // namespace
+
+void text_input_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "preview_file", cmd_preview_file, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "read_lines", cmd_read_lines, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "read_text", cmd_read_text, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "read_file_text", cmd_read_file_text, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "read_fields", cmd_read_fields, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "decode_text", cmd_decode_text, nullptr, nullptr);
+}
@@ -0,0 +1,29 @@
+// git-guing: native helpers for reading text from files and git
+
+#pragma once
+
+#include <tcl.h>
+#include <cstddef>
+#include <string>
+
+// Whether the buffer is valid UTF-8. If partial_tail is true, a multi-byte
+// sequence that is cut off by the end of the buffer is accepted.
+bool is_valid_utf8(const char* p, size_t len, bool partial_tail = false);
+
+// Whether the buffer is valid UTF-8 that can be used as a Tcl string as is:
+// it has no NUL bytes, and no characters Tcl represents differently.
+bool is_tcl_utf8(const char* p, size_t len);
+
+// Converts text in the given encoding to a new Tcl string. UTF-8 text that
+// passes is_tcl_utf8() is taken over without conversion.
+Tcl_Obj* decode_text(Tcl_Encoding enc, const char* p, size_t len);
+
+// Appends the Tcl string converted to the given encoding to out. Strings
+// that pass is_tcl_utf8() are taken over as UTF-8 without conversion.
+void encode_text(Tcl_Encoding enc, Tcl_Obj* obj, std::string& out);
+
+// Whether the buffer looks like binary data in the way git detects it: it
+// contains a NUL byte in the first few kilobytes.
+bool looks_binary(const char* p, size_t len);
+
+void text_input_init(Tcl_Interp* interp);
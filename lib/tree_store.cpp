@@ -0,0 +1,312 @@
+// git-guing: process-wide cache of tree listings
+//
+// Tree objects never change, so the listing of a tree that was read once
+// is kept for all later visits of the file browser. The trees are read
+// raw through the shared git cat-file --batch process and stored
+// compactly: the names of a listing share one string, and object ids are
+// kept in binary. The least recently used listings are dropped when the
+// cache grows beyond its memory budget.
+
+#include "tree_store.h"
+#include "cat_file.h"
+#include "native.h"
+#include "text_input.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const size_t memory_budget = 64 << 20;
+const size_t prefetch_budget = memory_budget / 4;	// per tree
+
+struct Entry
+{
+	uint32_t mode;
+	uint32_t name;		// offset into Listing::names
+	uint32_t name_len;
+};
+
+struct Listing
+{
+	std::string id;
+	std::vector<Entry> entries;
+	std::string names;
+	std::string oids;	// hash_len bytes per entry
+	size_t hash_len = 20;
+
+	size_t bytes() const
+	{
+		return id.size() + entries.size() * sizeof(Entry)
+			+ names.size() + oids.size() + 64;
+	}
+};
+
+std::list<Listing> lru;		// most recently used first
+std::unordered_map<std::string, std::list<Listing>::iterator> by_id;
+size_t used = 0;
+
+// Trees that commits and other names given as object ids resolve to.
+std::unordered_map<std::string, std::string> resolved;
+
+// How far reading the subtrees of a tree ahead has come.
+struct Prefetch
+{
+	size_t next = 0;	// entry to look at next
+	size_t bytes = 0;	// of the listings read so far
+};
+std::unordered_map<std::string, Prefetch> prefetches;	// by tree
+
+// The tree that is listed last, which is never dropped to make room.
+std::string pinned;
+
+const char* type_of(uint32_t mode)
+{
+	switch (mode & 0170000) {
+	case 0040000:
+		return "tree";
+	case 0160000:
+		return "commit";
+	default:
+		return "blob";
+	}
+}
+
+std::string hex(const char* p, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string r(len * 2, '0');
+	for (size_t i = 0; i < len; i++)
+	{
+		r[2 * i] = digits[(p[i] >> 4) & 15];
+		r[2 * i + 1] = digits[p[i] & 15];
+	}
+	return r;
+}
+
+Listing* find(const std::string& id)
+{
+	auto it = by_id.find(id);
+	if (it == by_id.end())
+		return nullptr;
+	lru.splice(lru.begin(), lru, it->second);
+	return &*it->second;
+}
+
+// Parses the raw tree object into a new listing.
+void add(const std::string& id, const std::string& raw)
+{
+	if (by_id.count(id))
+		return;
+	Listing l;
+	l.id = id;
+	l.hash_len = id.size() / 2;
+	for (size_t p = 0; p < raw.size(); )
+	{
+		auto sp = raw.find(' ', p);
+		auto nul = raw.find('\0', sp);
+		if (sp == std::string::npos || nul == std::string::npos
+				|| nul + 1 + l.hash_len > raw.size())
+			break;
+		Entry e;
+		e.mode = std::strtoul(raw.c_str() + p, nullptr, 8);
+		e.name = l.names.size();
+		e.name_len = nul - sp - 1;
+		l.names.append(raw, sp + 1, e.name_len);
+		l.oids.append(raw, nul + 1, l.hash_len);
+		l.entries.push_back(e);
+		p = nul + 1 + l.hash_len;
+	}
+
+	lru.push_front(std::move(l));
+	by_id[id] = lru.begin();
+	used += lru.front().bytes();
+	while (used > memory_budget && lru.size() > 1) {
+		auto old = std::prev(lru.end());
+		if (old->id == pinned)
+			old = std::prev(old);
+		if (old == lru.begin())
+			break;
+		used -= old->bytes();
+		by_id.erase(old->id);
+		prefetches.erase(old->id);
+		lru.erase(old);
+	}
+}
+
+// Reads the trees the names resolve to that are not in the cache yet,
+// and returns their ids, or empty strings for names that are no trees.
+std::vector<std::string> fetch(Tcl_Interp* interp, const std::vector<std::string>& names)
+{
+	std::vector<std::string> ids(names.size());
+	std::vector<std::string> todo;
+	std::vector<size_t> where;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		auto r = resolved.find(names[i]);
+		if (by_id.count(names[i])) {
+			ids[i] = names[i];
+		} else if (r != resolved.end() && by_id.count(r->second)) {
+			ids[i] = r->second;
+		} else {
+			// Everything after a colon names a path.
+			if (names[i].find(':') == std::string::npos)
+				todo.push_back(names[i] + "^{tree}");
+			else
+				todo.push_back(names[i]);
+			where.push_back(i);
+		}
+	}
+
+	std::vector<GitObject> objects;
+	cat_file(interp, todo, objects);
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		auto& o = objects[i];
+		if (o.type != "tree")
+			continue;
+		auto& name = names[where[i]];
+		add(o.id, o.data);
+		ids[where[i]] = o.id;
+		if (is_hex_id(name) && name != o.id)
+			resolved[name] = o.id;
+	}
+	Tcl_ResetResult(interp);
+	return ids;
+}
+
+// tree_store::fetch name
+// Returns the id of the tree that name, e.g. a commit or "HEAD:path",
+// refers to, and makes sure that its listing is cached. Returns an empty
+// string if name is no tree.
+int cmd_fetch(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "name");
+		return TCL_ERROR;
+	}
+	Tcl_SetObjResult(interp, tcl_obj(fetch(interp, {tcl_string(objv[1])})[0]));
+	return TCL_OK;
+}
+
+// tree_store::list tree ?first count?
+// Returns the listing of the tree as a flat list of mode, type, object id
+// and name of each entry, in the order of git ls-tree. Modes are octal,
+// as in git ls-tree. With first and count, only those entries are listed.
+// The tree is read if it is not cached.
+int cmd_list(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int first = 0, count = -1;
+	if (objc != 2 && objc != 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree ?first count?");
+		return TCL_ERROR;
+	}
+	if (objc == 4 && (!tcl_int(interp, objv[2], first) || !tcl_int(interp, objv[3], count)))
+		return TCL_ERROR;
+	auto id = fetch(interp, {tcl_string(objv[1])})[0];
+	auto l = find(id);
+	if (!l)
+		return TCL_OK;
+	pinned = id;
+
+	size_t begin = std::max(first, 0);
+	size_t end = l->entries.size();
+	if (count >= 0)
+		end = std::min(end, begin + count);
+
+	auto enc = Tcl_GetEncoding(nullptr, "utf-8");
+	auto result = Tcl_NewListObj(0, nullptr);
+	char mode[16];
+	for (size_t i = begin; i < end; i++)
+	{
+		auto& e = l->entries[i];
+		snprintf(mode, sizeof(mode), "%06o", e.mode);
+		Tcl_Obj* r[4] = {
+			Tcl_NewStringObj(mode, -1),
+			Tcl_NewStringObj(type_of(e.mode), -1),
+			tcl_obj(hex(l->oids.data() + i * l->hash_len, l->hash_len)),
+			decode_text(enc, l->names.data() + e.name, e.name_len),
+		};
+		for (auto o : r)
+			Tcl_ListObjAppendElement(nullptr, result, o);
+	}
+	Tcl_FreeEncoding(enc);
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+// tree_store::size tree
+// Returns the number of entries of the tree, which is read if it is not
+// cached.
+int cmd_size(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree");
+		return TCL_ERROR;
+	}
+	auto l = find(fetch(interp, {tcl_string(objv[1])})[0]);
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(l ? l->entries.size() : 0));
+	return TCL_OK;
+}
+
+// tree_store::prefetch tree limit
+// Reads the listings of at most limit subtrees of the cached tree that
+// are not cached yet, continuing where the last call for the tree
+// stopped, and returns how many entries are left to look at. Stops for
+// good once the listings read for the tree take up a quarter of the
+// cache.
+int cmd_prefetch(ClientData, Tcl_Interp* interp, int objc, Tcl_Obj* const objv[])
+{
+	int limit;
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "tree limit");
+		return TCL_ERROR;
+	}
+	if (!tcl_int(interp, objv[2], limit))
+		return TCL_ERROR;
+	auto it = by_id.find(tcl_string(objv[1]));
+	if (it == by_id.end()) {
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(0));
+		return TCL_OK;
+	}
+
+	auto& l = *it->second;
+	auto& p = prefetches[l.id];
+	pinned = l.id;
+	std::vector<std::string> todo;
+	while (p.next < l.entries.size() && int(todo.size()) < limit
+			&& p.bytes < prefetch_budget) {
+		size_t i = p.next++;
+		if ((l.entries[i].mode & 0170000) != 0040000)
+			continue;
+		auto id = hex(l.oids.data() + i * l.hash_len, l.hash_len);
+		if (!by_id.count(id))
+			todo.push_back(id);
+	}
+
+	for (auto& id : fetch(interp, todo))
+	{
+		auto f = by_id.find(id);
+		if (f != by_id.end())
+			p.bytes += f->second->bytes();
+	}
+	int left = p.bytes < prefetch_budget ? l.entries.size() - p.next : 0;
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(left));
+	return TCL_OK;
+}
+
+} // namespace
+
+void tree_store_init(Tcl_Interp* interp)
+{
+	Tcl_CreateObjCommand(interp, "tree_store::fetch", cmd_fetch, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "tree_store::list", cmd_list, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "tree_store::prefetch", cmd_prefetch, nullptr, nullptr);
+	Tcl_CreateObjCommand(interp, "tree_store::size", cmd_size, nullptr, nullptr);
+}
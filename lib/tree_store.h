@@ -0,0 +1,7 @@
+// git-guing: process-wide cache of tree listings
+
+#pragma once
+
+#include <tcl.h>
+
+void tree_store_init(Tcl_Interp* interp);
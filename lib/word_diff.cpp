@@ -0,0 +1,186 @@
+// git-guing: word-level differences between blocks of lines
+//
+// The lines are split into tokens (runs of word characters, runs of
+// white-space, and single punctuation characters), which are then compared
+// with Myers' O(ND) difference algorithm.
+
+#include "word_diff.h"
+#include <unordered_map>
+
+namespace {
+
+// Comparisons of larger blocks are not worth the time.
+const int max_tokens = 4000;
+const int max_edits = 400;
+
+struct Token
+{
+	int id;			// equal tokens have equal ids
+	int line;
+	int begin, end;		// character columns
+	bool space;
+};
+
+bool is_word_byte(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+		|| (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+bool is_space_byte(unsigned char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+class Tokenizer
+{
+public:
+	void split(const std::vector<std::string>& lines, std::vector<Token>& tokens)
+	{
+		for (int l = 0; l < int(lines.size()); l++)
+		{
+			const auto& s = lines[l];
+			int col = 0;
+			for (size_t i = 0; i < s.size(); ) {
+				auto c = (unsigned char)s[i];
+				size_t j = i + 1;
+				if (is_word_byte(c)) {
+					while (j < s.size() && is_word_byte(s[j]))
+						j++;
+				} else if (is_space_byte(c)) {
+					while (j < s.size() && is_space_byte(s[j]))
+						j++;
+				}
+				int chars = 0;
+				for (size_t k = i; k < j; k++)
+					if ((s[k] & 0xc0) != 0x80)
+						chars++;
+				auto id = ids.emplace(s.substr(i, j - i), int(ids.size())).first->second;
+				tokens.push_back({ id, l, col, col + chars, is_space_byte(c) });
+				col += chars;
+				i = j;
+			}
+			// the line break is a token of its own
+			auto id = ids.emplace("\n", int(ids.size())).first->second;
+			tokens.push_back({ id, l, col, col, true });
+		}
+	}
+
+private:
+	std::unordered_map<std::string, int> ids;
+};
+
+// Marks the tokens of a and b that are part of the longest common
+// subsequence. Returns false if the edit distance is too large.
+bool myers(const std::vector<Token>& a, const std::vector<Token>& b,
+		std::vector<bool>& a_common, std::vector<bool>& b_common)
+{
+	int n = a.size(), m = b.size();
+	a_common.assign(n, false);
+	b_common.assign(m, false);
+
+	// trace[d] holds V[k] for k = -d..d (stored at index k + d)
+	std::vector<std::vector<int>> trace;
+	int x = 0, y = 0;
+	int d = 0;
+	for (;; d++)
+	{
+		if (d > max_edits)
+			return false;
+		std::vector<int> v(2 * d + 1);
+		bool done = false;
+		for (int k = -d; k <= d; k += 2)
+		{
+			if (d == 0) {
+				x = 0;
+			} else {
+				const auto& p = trace[d - 1];
+				if (k == -d || (k != d && p[k - 1 + d - 1] < p[k + 1 + d - 1]))
+					x = p[k + 1 + d - 1];
+				else
+					x = p[k - 1 + d - 1] + 1;
+			}
+			y = x - k;
+			while (x < n && y < m && a[x].id == b[y].id)
+				x++, y++;
+			v[k + d] = x;
+			if (x >= n && y >= m) {
+				done = true;
+				break;
+			}
+		}
+		trace.push_back(std::move(v));
+		if (done)
+			break;
+	}
+
+	// walk back through the trace and mark the snakes
+	x = n, y = m;
+	for (; d > 0; d--)
+	{
+		const auto& p = trace[d - 1];
+		int k = x - y;
+		int pk;
+		if (k == -d || (k != d && p[k - 1 + d - 1] < p[k + 1 + d - 1]))
+			pk = k + 1;
+		else
+			pk = k - 1;
+		int px = p[pk + d - 1];
+		int py = px - pk;
+		while (x > px && y > py) {
+			--x, --y;
+			a_common[x] = b_common[y] = true;
+		}
+		x = px, y = py;
+	}
+	while (x > 0 && y > 0)
+		a_common[--x] = b_common[--y] = true;
+	return true;
+}
+
+void collect(const std::vector<Token>& tokens, const std::vector<bool>& common,
+		std::vector<WordChange>& changes)
+{
+	for (size_t i = 0; i < tokens.size(); i++)
+	{
+		const auto& t = tokens[i];
+		if (common[i] || t.begin == t.end)
+			continue;
+		// merge with the preceding change on the same line
+		if (!changes.empty() && changes.back().line == t.line
+		    && changes.back().end == t.begin)
+			changes.back().end = t.end;
+		else
+			changes.push_back({ t.line, t.begin, t.end });
+	}
+}
+
+} // namespace
+
+void word_diff(const std::vector<std::string>& old_lines,
+		const std::vector<std::string>& new_lines,
+		std::vector<WordChange>& old_changes,
+		std::vector<WordChange>& new_changes)
+{
+	Tokenizer tokenizer;
+	std::vector<Token> a, b;
+	tokenizer.split(old_lines, a);
+	tokenizer.split(new_lines, b);
+	if (int(a.size()) > max_tokens || int(b.size()) > max_tokens)
+		return;
+
+	std::vector<bool> a_common, b_common;
+	if (!myers(a, b, a_common, b_common))
+		return;
+
+	// If only white-space and line breaks are common, the blocks are
+	// unrelated and highlighting everything would only be noise.
+	bool related = false;
+	for (size_t i = 0; i < a.size() && !related; i++)
+		related = a_common[i] && !a[i].space;
+	if (!related)
+		return;
+
+	collect(a, a_common, old_changes);
+	collect(b, b_common, new_changes);
+}
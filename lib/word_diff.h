@@ -0,0 +1,21 @@
+// git-guing: word-level differences between blocks of lines
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct WordChange
+{
+	int line;		// index into the block
+	int begin, end;		// character (not byte) columns
+};
+
+// Compares the removed lines old_lines with the added lines new_lines word by
+// word and appends the ranges that differ to old_changes and new_changes.
+// Nothing is reported if the blocks have no words in common or are too
+// large to compare in reasonable time.
+void word_diff(const std::vector<std::string>& old_lines,
+		const std::vector<std::string>& new_lines,
+		std::vector<WordChange>& old_changes,
+		std::vector<WordChange>& new_changes);